@@ -0,0 +1,448 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <execution>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include "concurrent_search_server.h"
+#include "generators.h"
+#include "process_queries.h"
+#include "remove_duplicates.h"
+#include "search_server.h"
+#include "segmented_search_server.h"
+#include "string_processing.h"
+
+// Every benchmark takes the corpus parameters as arguments:
+// document count, vocabulary size, words per document, words per query, minus word percentage.
+// Results are printed as JSON unless another --benchmark_format is given
+
+namespace {
+
+const int QUERY_COUNT = 100;
+const int REMOVED_DOCUMENT_COUNT = 100;
+const int MATCHED_DOCUMENT_COUNT = 100;
+
+struct Corpus {
+    std::vector<std::string> dictionary;
+    std::vector<std::string> documents;
+    std::vector<std::string> queries;
+    std::unique_ptr<SearchServer> search_server;
+};
+
+DocumentStatus StatusOf(int document_id) {
+    return document_id % 4 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+}
+
+void AddCorpusDocuments(SearchServer& search_server, const std::vector<std::string>& documents) {
+    for (size_t i = 0; i < documents.size(); ++i) {
+        search_server.AddDocument(i, documents[i], StatusOf(i), {1, 2, 3});
+    }
+}
+
+// Corpora are expensive to index, so each parameter set is generated once and shared
+const Corpus& GetCorpus(const benchmark::State& state) {
+    static std::map<std::tuple<int64_t, int64_t, int64_t, int64_t, int64_t>, Corpus> corpora;
+    const auto key = std::make_tuple(state.range(0), state.range(1), state.range(2), state.range(3), state.range(4));
+    const auto found = corpora.find(key);
+    if (found != corpora.end()) {
+        return found->second;
+    }
+    std::mt19937 generator;
+    Corpus corpus;
+    corpus.dictionary = GenerateDictionary(generator, state.range(1), 10);
+    corpus.documents = GenerateQueries(generator, corpus.dictionary, state.range(0), state.range(2));
+    corpus.queries = GenerateQueries(generator, corpus.dictionary, QUERY_COUNT, state.range(3), state.range(4) / 100.0);
+    corpus.search_server = std::make_unique<SearchServer>(corpus.dictionary[0]);
+    AddCorpusDocuments(*corpus.search_server, corpus.documents);
+    return corpora.emplace(key, std::move(corpus)).first->second;
+}
+
+void CorpusArguments(benchmark::internal::Benchmark* benchmark) {
+    benchmark->ArgNames({"documents", "vocabulary", "document_words", "query_words", "minus_percent"});
+    benchmark->Args({1'000, 1'000, 20, 5, 0});
+    benchmark->Args({10'000, 1'000, 70, 70, 0});
+    benchmark->Args({10'000, 10'000, 70, 10, 20});
+    benchmark->Unit(benchmark::kMicrosecond);
+}
+
+// Tokenizing the documents into a reused buffer, as ingestion does
+void BM_SplitIntoWords(benchmark::State& state) {
+    const Corpus& corpus = GetCorpus(state);
+    const WordSeparators separators;
+    SplitText split_text;
+    size_t byte_count = 0;
+    for (const std::string& document : corpus.documents) {
+        byte_count += document.size();
+    }
+    for (auto _ : state) {
+        for (const std::string& document : corpus.documents) {
+            SplitIntoWords(document, separators, split_text);
+            benchmark::DoNotOptimize(split_text.words.data());
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * byte_count);
+}
+
+void BM_AddDocument(benchmark::State& state) {
+    const Corpus& corpus = GetCorpus(state);
+    for (auto _ : state) {
+        SearchServer search_server(corpus.dictionary[0]);
+        AddCorpusDocuments(search_server, corpus.documents);
+        benchmark::DoNotOptimize(search_server.GetDocumentCount());
+    }
+    state.SetItemsProcessed(state.iterations() * corpus.documents.size());
+}
+
+// Ingestion into a segmented index, including the background merges it triggers
+void BM_AddDocumentSegmented(benchmark::State& state) {
+    const Corpus& corpus = GetCorpus(state);
+    for (auto _ : state) {
+        SegmentedSearchServer search_server(corpus.dictionary[0]);
+        for (size_t i = 0; i < corpus.documents.size(); ++i) {
+            search_server.AddDocument(i, corpus.documents[i], StatusOf(i), {1, 2, 3});
+        }
+        search_server.Refresh();
+        search_server.WaitForMerges();
+        benchmark::DoNotOptimize(search_server.GetDocumentCount());
+    }
+    state.SetItemsProcessed(state.iterations() * corpus.documents.size());
+}
+
+template <typename ExecutionPolicy>
+void BM_FindTopDocuments(benchmark::State& state, ExecutionPolicy policy) {
+    const Corpus& corpus = GetCorpus(state);
+    size_t query = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(corpus.search_server->FindTopDocuments(policy, corpus.queries[query]));
+        query = (query + 1) % corpus.queries.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Searches of all documents ranked by BM25 instead of TF-IDF
+template <typename ExecutionPolicy>
+void BM_FindTopDocumentsBm25(benchmark::State& state, ExecutionPolicy policy) {
+    const Corpus& corpus = GetCorpus(state);
+    const Bm25Ranking ranking;
+    const auto all = [](int, DocumentStatus, int) {
+        return true;
+    };
+    size_t query = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(corpus.search_server->FindTopDocuments(policy, corpus.queries[query], all, ranking));
+        query = (query + 1) % corpus.queries.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Searches under a deadline they never reach, the cost of checking it
+template <typename ExecutionPolicy>
+void BM_FindTopDocumentsLimited(benchmark::State& state, ExecutionPolicy policy) {
+    const Corpus& corpus = GetCorpus(state);
+    const DocumentFilter actual = DocumentFilter::ByStatus(DocumentStatus::ACTUAL);
+    size_t query = 0;
+    for (auto _ : state) {
+        const SearchLimits limits = SearchLimits::Within(std::chrono::seconds(10));
+        benchmark::DoNotOptimize(corpus.search_server->FindTopDocuments(policy, corpus.queries[query], actual, limits));
+        query = (query + 1) % corpus.queries.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Sequential search over a copy of the index with score pruning on
+void BM_FindTopDocumentsPruned(benchmark::State& state) {
+    const Corpus& corpus = GetCorpus(state);
+    SearchServer search_server(*corpus.search_server);
+    search_server.SetScorePruning(true);
+    size_t query = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(search_server.FindTopDocuments(corpus.queries[query]));
+        query = (query + 1) % corpus.queries.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Sequential search over a copy of the index with compressed posting lists
+void BM_FindTopDocumentsCompressed(benchmark::State& state) {
+    const Corpus& corpus = GetCorpus(state);
+    SearchServer search_server(*corpus.search_server);
+    search_server.CompressPostings();
+    size_t query = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(search_server.FindTopDocuments(corpus.queries[query]));
+        query = (query + 1) % corpus.queries.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Sequential search through a result cache holding a quarter of the queries.
+// The i-th query is asked about 1 / (i + 1) as often as the first one, like real traffic
+void BM_FindTopDocumentsCached(benchmark::State& state) {
+    const Corpus& corpus = GetCorpus(state);
+    SearchServer search_server(*corpus.search_server);
+    search_server.SetResultCacheCapacity(QUERY_COUNT / 4);
+    std::vector<double> popularity;
+    for (size_t query = 0; query < corpus.queries.size(); ++query) {
+        popularity.push_back(1.0 / (query + 1));
+    }
+    std::discrete_distribution<size_t> distribution(popularity.begin(), popularity.end());
+    std::mt19937 generator;
+    std::vector<size_t> queries(10 * QUERY_COUNT);
+    for (size_t& query : queries) {
+        query = distribution(generator);
+    }
+    size_t position = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(search_server.FindTopDocuments(corpus.queries[queries[position]]));
+        position = (position + 1) % queries.size();
+    }
+    const ResultCacheStats stats = search_server.GetResultCacheStats();
+    state.counters["hit_rate"] = stats.hits * 1.0 / std::max<uint64_t>(stats.hits + stats.misses, 1);
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Sequential search while another thread keeps publishing new generations of the index
+void BM_FindTopDocumentsDuringWrites(benchmark::State& state) {
+    const Corpus& corpus = GetCorpus(state);
+    ConcurrentSearchServer search_server(*corpus.search_server);
+    std::atomic<bool> stopped = false;
+    std::thread writer([&corpus, &search_server, &stopped] {
+        // Every generation adds or removes a batch of documents
+        const size_t batch_size = 64;
+        std::vector<RawDocument> documents;
+        std::vector<int> document_ids;
+        for (size_t i = 0; i < batch_size; ++i) {
+            documents.push_back({static_cast<int>(corpus.documents.size() + i), corpus.documents[i % corpus.documents.size()], DocumentStatus::ACTUAL, {1, 2, 3}});
+            document_ids.push_back(documents.back().id);
+        }
+        while (!stopped.load()) {
+            search_server.AddDocuments(documents);
+            search_server.RemoveDocuments(document_ids);
+        }
+    });
+    size_t query = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(search_server.FindTopDocuments(corpus.queries[query]));
+        query = (query + 1) % corpus.queries.size();
+    }
+    stopped = true;
+    writer.join();
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Sequential search over the corpus indexed in segments of 1024 documents
+void BM_FindTopDocumentsSegmented(benchmark::State& state) {
+    const Corpus& corpus = GetCorpus(state);
+    SegmentedSearchServer search_server(corpus.dictionary[0]);
+    for (size_t i = 0; i < corpus.documents.size(); ++i) {
+        search_server.AddDocument(i, corpus.documents[i], StatusOf(i), {1, 2, 3});
+    }
+    search_server.Refresh();
+    search_server.WaitForMerges();
+    size_t query = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(search_server.FindTopDocuments(corpus.queries[query]));
+        query = (query + 1) % corpus.queries.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename ExecutionPolicy>
+void BM_FindTopDocumentsByStatus(benchmark::State& state, ExecutionPolicy policy) {
+    const Corpus& corpus = GetCorpus(state);
+    size_t query = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(corpus.search_server->FindTopDocuments(policy, corpus.queries[query], DocumentStatus::BANNED));
+        query = (query + 1) % corpus.queries.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename ExecutionPolicy>
+void BM_FindTopDocumentsByPredicate(benchmark::State& state, ExecutionPolicy policy) {
+    const Corpus& corpus = GetCorpus(state);
+    const auto predicate = [](int document_id, DocumentStatus, int) {
+        return document_id % 2 == 0;
+    };
+    size_t query = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(corpus.search_server->FindTopDocuments(policy, corpus.queries[query], predicate));
+        query = (query + 1) % corpus.queries.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Statuses and a rating range checked against the attribute columns before scoring
+template <typename ExecutionPolicy>
+void BM_FindTopDocumentsByFilter(benchmark::State& state, ExecutionPolicy policy) {
+    const Corpus& corpus = GetCorpus(state);
+    DocumentFilter filter;
+    filter.statuses = 1u << static_cast<int>(DocumentStatus::ACTUAL) | 1u << static_cast<int>(DocumentStatus::BANNED);
+    filter.min_rating = 2;
+    size_t query = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(corpus.search_server->FindTopDocuments(policy, corpus.queries[query], filter));
+        query = (query + 1) % corpus.queries.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename ExecutionPolicy>
+void BM_MatchDocument(benchmark::State& state, ExecutionPolicy policy) {
+    const Corpus& corpus = GetCorpus(state);
+    size_t query = 0;
+    int document_id = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(corpus.search_server->MatchDocument(policy, corpus.queries[query], document_id));
+        query = (query + 1) % corpus.queries.size();
+        document_id = (document_id + 1) % corpus.documents.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Matches a query with a batch of consecutive documents at once
+template <typename ExecutionPolicy>
+void BM_MatchDocuments(benchmark::State& state, ExecutionPolicy policy) {
+    const Corpus& corpus = GetCorpus(state);
+    const int batch_size = std::min<int>(MATCHED_DOCUMENT_COUNT, corpus.documents.size());
+    std::vector<int> document_ids(batch_size);
+    size_t query = 0;
+    int first_document_id = 0;
+    for (auto _ : state) {
+        for (int i = 0; i < batch_size; ++i) {
+            document_ids[i] = (first_document_id + i) % corpus.documents.size();
+        }
+        benchmark::DoNotOptimize(corpus.search_server->MatchDocuments(policy, corpus.queries[query], document_ids));
+        query = (query + 1) % corpus.queries.size();
+        first_document_id = (first_document_id + batch_size) % corpus.documents.size();
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size);
+}
+
+// Removes a spread of documents from a fresh copy of the index every iteration
+template <typename ExecutionPolicy>
+void BM_RemoveDocument(benchmark::State& state, ExecutionPolicy policy) {
+    const Corpus& corpus = GetCorpus(state);
+    const int step = std::max<int>(1, corpus.documents.size() / REMOVED_DOCUMENT_COUNT);
+    for (auto _ : state) {
+        state.PauseTiming();
+        SearchServer search_server(*corpus.search_server);
+        state.ResumeTiming();
+        for (size_t document_id = 0; document_id < corpus.documents.size(); document_id += step) {
+            search_server.RemoveDocument(policy, document_id);
+        }
+        benchmark::DoNotOptimize(search_server.GetDocumentCount());
+    }
+    state.SetItemsProcessed(state.iterations() * ((corpus.documents.size() + step - 1) / step));
+}
+
+void BM_ProcessQueries(benchmark::State& state) {
+    const Corpus& corpus = GetCorpus(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ProcessQueries(*corpus.search_server, corpus.queries));
+    }
+    state.SetItemsProcessed(state.iterations() * corpus.queries.size());
+}
+
+void BM_ProcessQueriesJoined(benchmark::State& state) {
+    const Corpus& corpus = GetCorpus(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ProcessQueriesJoined(*corpus.search_server, corpus.queries));
+    }
+    state.SetItemsProcessed(state.iterations() * corpus.queries.size());
+}
+
+void BM_ProcessQueriesStreamed(benchmark::State& state) {
+    const Corpus& corpus = GetCorpus(state);
+    for (auto _ : state) {
+        size_t document_count = 0;
+        ProcessQueriesStreamed(*corpus.search_server, corpus.queries, [&document_count](size_t, const std::vector<Document>& documents) {
+            document_count += documents.size();
+        });
+        benchmark::DoNotOptimize(document_count);
+    }
+    state.SetItemsProcessed(state.iterations() * corpus.queries.size());
+}
+
+// Every tenth document is re-added under a new id, so a tenth of the copy is duplicates
+template <typename Remover>
+void BM_RemoveDuplicates(benchmark::State& state, Remover remover) {
+    const Corpus& corpus = GetCorpus(state);
+    SearchServer with_duplicates(*corpus.search_server);
+    for (size_t i = 0; i < corpus.documents.size(); i += 10) {
+        with_duplicates.AddDocument(corpus.documents.size() + i, corpus.documents[i], DocumentStatus::ACTUAL, {1, 2, 3});
+    }
+    // RemoveDuplicates reports every removed id, which would interleave with the JSON on stdout
+    std::ostringstream report;
+    std::streambuf* const stdout_buffer = std::cout.rdbuf(report.rdbuf());
+    for (auto _ : state) {
+        state.PauseTiming();
+        SearchServer search_server(with_duplicates);
+        report.str({});
+        state.ResumeTiming();
+        remover(search_server);
+        benchmark::DoNotOptimize(search_server.GetDocumentCount());
+    }
+    std::cout.rdbuf(stdout_buffer);
+    state.SetItemsProcessed(state.iterations() * with_duplicates.GetDocumentCount());
+}
+
+}  // namespace
+
+BENCHMARK(BM_SplitIntoWords)->Apply(CorpusArguments);
+BENCHMARK(BM_AddDocument)->Apply(CorpusArguments);
+BENCHMARK(BM_AddDocumentSegmented)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_FindTopDocuments, seq, std::execution::seq)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_FindTopDocuments, par, std::execution::par)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_FindTopDocumentsBm25, seq, std::execution::seq)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_FindTopDocumentsBm25, par, std::execution::par)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_FindTopDocumentsLimited, seq, std::execution::seq)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_FindTopDocumentsLimited, par, std::execution::par)->Apply(CorpusArguments);
+BENCHMARK(BM_FindTopDocumentsPruned)->Apply(CorpusArguments);
+BENCHMARK(BM_FindTopDocumentsCompressed)->Apply(CorpusArguments);
+BENCHMARK(BM_FindTopDocumentsCached)->Apply(CorpusArguments);
+BENCHMARK(BM_FindTopDocumentsDuringWrites)->Apply(CorpusArguments);
+BENCHMARK(BM_FindTopDocumentsSegmented)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_FindTopDocumentsByStatus, seq, std::execution::seq)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_FindTopDocumentsByStatus, par, std::execution::par)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_FindTopDocumentsByPredicate, seq, std::execution::seq)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_FindTopDocumentsByPredicate, par, std::execution::par)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_FindTopDocumentsByFilter, seq, std::execution::seq)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_FindTopDocumentsByFilter, par, std::execution::par)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_MatchDocument, seq, std::execution::seq)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_MatchDocument, par, std::execution::par)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_MatchDocuments, seq, std::execution::seq)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_MatchDocuments, par, std::execution::par)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_RemoveDocument, seq, std::execution::seq)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_RemoveDocument, par, std::execution::par)->Apply(CorpusArguments);
+BENCHMARK(BM_ProcessQueries)->Apply(CorpusArguments);
+BENCHMARK(BM_ProcessQueriesJoined)->Apply(CorpusArguments);
+BENCHMARK(BM_ProcessQueriesStreamed)->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_RemoveDuplicates, exact, [](SearchServer& search_server) {
+    RemoveDuplicates(search_server);
+})->Apply(CorpusArguments);
+BENCHMARK_CAPTURE(BM_RemoveDuplicates, near, [](SearchServer& search_server) {
+    RemoveNearDuplicates(search_server, 0.8);
+})->Apply(CorpusArguments);
+
+int main(int argc, char** argv) {
+    // JSON by default; a later --benchmark_format on the command line still wins
+    std::vector<char*> arguments(argv, argv + argc);
+    char json_format[] = "--benchmark_format=json";
+    arguments.insert(arguments.begin() + 1, json_format);
+    int argument_count = arguments.size();
+    benchmark::Initialize(&argument_count, arguments.data());
+    if (benchmark::ReportUnrecognizedArguments(argument_count, arguments.data())) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+}
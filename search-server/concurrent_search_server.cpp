@@ -0,0 +1,29 @@
+#include "concurrent_search_server.h"
+
+ConcurrentSearchServer::ConcurrentSearchServer(SearchServer search_server)
+    : index_(std::make_shared<const SearchServer>(std::move(search_server))) {
+}
+
+std::shared_ptr<const SearchServer> ConcurrentSearchServer::Pin() const {
+    return index_.Pin();
+}
+
+std::vector<std::vector<Document>> ConcurrentSearchServer::FindTopDocumentsBatch(const std::vector<std::string>& raw_queries) const {
+    return Pin()->FindTopDocumentsBatch(raw_queries);
+}
+
+int ConcurrentSearchServer::GetDocumentCount() const {
+    return Pin()->GetDocumentCount();
+}
+
+void ConcurrentSearchServer::AddDocuments(const std::vector<RawDocument>& documents) {
+    Update([&documents](SearchServer& search_server) {
+        search_server.AddDocuments(std::execution::par, documents);
+    });
+}
+
+void ConcurrentSearchServer::RemoveDocuments(const std::vector<int>& document_ids) {
+    Update([&document_ids](SearchServer& search_server) {
+        search_server.RemoveDocuments(std::execution::par, document_ids);
+    });
+}
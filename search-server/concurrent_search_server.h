@@ -0,0 +1,69 @@
+#pragma once
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "published.h"
+#include "search_server.h"
+#include "search_thread_pool.h"
+
+// Lets queries run while documents are added and removed.
+// The index is published in generations: a generation is a SearchServer that is never changed once
+// published. A reader pins the current generation and searches it without waiting for writers.
+// A writer applies its changes to a private copy of the current generation and publishes the copy
+// atomically, readers that pinned the old one finish on it undisturbed.
+// The copy shares the posting blocks, forward index chunks, id pages and words of the current
+// generation and copies only the parts the writer changes, so on top of the change itself a write
+// costs a pointer per posting list and per 64 documents.
+class ConcurrentSearchServer {
+public:
+    explicit ConcurrentSearchServer(SearchServer search_server);
+
+    // The current generation, it stays valid and unchanged for as long as the pointer is held.
+    // Several calls on one pinned generation see the same documents, and views returned
+    // by it (e.g. the words of MatchDocument) stay valid while it is held
+    std::shared_ptr<const SearchServer> Pin() const;
+
+    // Any const query of SearchServer, answered by the current generation
+    template <typename... Args>
+    auto FindTopDocuments(Args&&... args) const {
+        return Pin()->FindTopDocuments(std::forward<Args>(args)...);
+    }
+
+    // Like SearchServer::FindTopDocumentsAsync, args end with the SearchLimits. The generation stays pinned until the search ends
+    template <typename... Args>
+    std::future<SearchResult> FindTopDocumentsAsync(std::string raw_query, Args... args) const {
+        return SearchThreadPool::Get().Submit([index = Pin(), raw_query = std::move(raw_query), args...] {
+            return index->FindTopDocuments(raw_query, args...);
+        });
+    }
+
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::vector<std::string>& raw_queries) const;
+    int GetDocumentCount() const;
+
+    // Every call publishes a generation, other changes can be grouped with these through Update
+    void AddDocuments(const std::vector<RawDocument>& documents);
+    void RemoveDocuments(const std::vector<int>& document_ids);
+
+    // Calls update(SearchServer&) on a copy of the current generation and publishes the result as
+    // the next one. Writers take turns, readers are not blocked. If update throws, nothing is published
+    template <typename Updater>
+    void Update(Updater update);
+
+private:
+    Published<SearchServer> index_;
+    // Serializes writers
+    std::mutex write_mutex_;
+};
+
+template <typename Updater>
+void ConcurrentSearchServer::Update(Updater update) {
+    std::lock_guard guard(write_mutex_);
+    auto next = std::make_shared<SearchServer>(index_.Get());
+    update(*next);
+    index_.Publish(std::move(next));
+}
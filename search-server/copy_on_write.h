@@ -0,0 +1,19 @@
+#pragma once
+#include <atomic>
+#include <memory>
+
+// Copy-on-write for structures whose copies share their parts: returns the part behind pointer
+// ready to be changed in place, copied first if another copy still shares it.
+// A null pointer gets a new empty part
+template <typename T>
+T& GetOwnCopy(std::shared_ptr<T>& part) {
+    if (!part) {
+        part = std::make_shared<T>();
+    } else if (part.use_count() > 1) {
+        part = std::make_shared<T>(*part);
+    } else {
+        // Pairs with the release of the last other owner, whose reads are done by now
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *part;
+}
@@ -1,5 +1,9 @@
 #pragma once
+#include <cstdint>
 #include <iostream>
+#include <limits>
+#include <string_view>
+#include <vector>
 struct Document {
     Document() = default;
 
@@ -20,3 +24,55 @@ enum class DocumentStatus {
     BANNED,
     REMOVED,
 };
+
+const int DOCUMENT_STATUS_COUNT = 4;
+
+// A condition on document attributes that SearchServer evaluates itself, over whole attribute arrays
+// and status bitmaps at once, instead of calling a predicate for every posting
+struct DocumentFilter {
+    static constexpr uint32_t ALL_STATUSES = (1u << DOCUMENT_STATUS_COUNT) - 1;
+
+    static DocumentFilter ByStatus(DocumentStatus status) {
+        DocumentFilter filter;
+        filter.statuses = 1u << static_cast<int>(status);
+        return filter;
+    }
+
+    // Bit 1 << status for every accepted status
+    uint32_t statuses = ALL_STATUSES;
+    // Inclusive range of accepted ratings
+    int min_rating = std::numeric_limits<int>::min();
+    int max_rating = std::numeric_limits<int>::max();
+
+    bool HasRatingRange() const {
+        return min_rating != std::numeric_limits<int>::min() || max_rating != std::numeric_limits<int>::max();
+    }
+
+    // The same condition as a predicate
+    bool operator()(int /*document_id*/, DocumentStatus status, int rating) const {
+        return (statuses >> static_cast<int>(status) & 1) && rating >= min_rating && rating <= max_rating;
+    }
+};
+
+// One input document of SearchServer::AddDocuments, the text must outlive the call only
+struct RawDocument {
+    int id = 0;
+    std::string_view text;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+};
+
+// Matches of one query with many documents in one buffer, like SearchServer::MatchDocument for each of them:
+// the words of the i-th document are words[offsets[i]] ... words[offsets[i + 1] - 1]
+struct DocumentMatches {
+    std::vector<std::string_view> words;
+    std::vector<size_t> offsets;
+    std::vector<DocumentStatus> statuses;
+};
+
+// Documents of a search under SearchLimits. A partial result comes from a search stopped early:
+// the best documents among the postings scanned by then, ranked by their relevance so far
+struct SearchResult {
+    std::vector<Document> documents;
+    bool is_partial = false;
+};
@@ -0,0 +1,52 @@
+#include "document_attributes.h"
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Bit i is set if ratings[i] is in [min_rating, max_rating], count <= 64
+uint64_t SelectRatings(const int* ratings, size_t count, int min_rating, int max_rating) {
+    uint64_t bits = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i min = _mm_set1_epi32(min_rating);
+    const __m128i max = _mm_set1_epi32(max_rating);
+    for (; i + 4 <= count; i += 4) {
+        const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ratings + i));
+        const __m128i outside = _mm_or_si128(_mm_cmplt_epi32(values, min), _mm_cmpgt_epi32(values, max));
+        bits |= static_cast<uint64_t>(~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xF) << i;
+    }
+#endif
+    for (; i < count; ++i) {
+        bits |= static_cast<uint64_t>(ratings[i] >= min_rating && ratings[i] <= max_rating) << i;
+    }
+    return bits;
+}
+
+}
+
+void DocumentAttributes::Select(const DocumentFilter& filter, std::pmr::vector<uint64_t>& bits) const {
+    const size_t word_count = (ids_.size() + 63) / 64;
+    bits.assign(word_count, 0);
+    for (int status = 0; status < DOCUMENT_STATUS_COUNT; ++status) {
+        if (filter.statuses >> status & 1) {
+            const auto& status_bits = status_bits_[status];
+            for (size_t word = 0; word < word_count; ++word) {
+                bits[word] |= status_bits[word];
+            }
+        }
+    }
+    if (!filter.HasRatingRange()) {
+        return;
+    }
+    // Ratings are read only where the statuses left some documents
+    for (size_t word = 0; word < word_count; ++word) {
+        if (bits[word] != 0) {
+            const size_t begin = word * 64;
+            bits[word] &= SelectRatings(ratings_.data() + begin, std::min<size_t>(64, ids_.size() - begin), filter.min_rating, filter.max_rating);
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "document.h"
+#include <array>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+// Attributes of the documents by internal index, a dense array each, so a search reads only
+// the attributes it uses. Every status also has a bitmap of the live documents in it
+class DocumentAttributes {
+public:
+    // Index of the new document
+    int Add(int id, int rating, DocumentStatus status, int word_count) {
+        const int index = ids_.size();
+        if (index % 64 == 0) {
+            for (auto& bits : status_bits_) {
+                bits.push_back(0);
+            }
+        }
+        ids_.push_back(id);
+        ratings_.push_back(rating);
+        statuses_.push_back(status);
+        word_counts_.push_back(word_count);
+        status_bits_[static_cast<int>(status)][index / 64] |= uint64_t{1} << (index % 64);
+        return index;
+    }
+
+    // The index stays taken until the server compacts its documents, only the status bitmap forgets the document
+    void Remove(int index) {
+        status_bits_[static_cast<int>(statuses_[index])][index / 64] &= ~(uint64_t{1} << (index % 64));
+    }
+
+    void reserve(size_t count) {
+        ids_.reserve(count);
+        ratings_.reserve(count);
+        statuses_.reserve(count);
+        word_counts_.reserve(count);
+    }
+
+    // Documents added since the last compaction, removed ones included
+    size_t size() const {
+        return ids_.size();
+    }
+
+    int GetId(int index) const {
+        return ids_[index];
+    }
+
+    int GetRating(int index) const {
+        return ratings_[index];
+    }
+
+    DocumentStatus GetStatus(int index) const {
+        return statuses_[index];
+    }
+
+    // Words without stop words, every term frequency of the document is a count times its inverse
+    int GetWordCount(int index) const {
+        return word_counts_[index];
+    }
+
+    // Bit index % 64 of word index / 64 is set for the live documents with the status
+    const uint64_t* GetStatusBits(DocumentStatus status) const {
+        return status_bits_[static_cast<int>(status)].data();
+    }
+
+    // Fills bits with the same kind of bitmap for the live documents passing filter
+    void Select(const DocumentFilter& filter, std::pmr::vector<uint64_t>& bits) const;
+
+private:
+    std::vector<int> ids_;
+    std::vector<int> ratings_;
+    std::vector<DocumentStatus> statuses_;
+    std::vector<int> word_counts_;
+    std::array<std::vector<uint64_t>, DOCUMENT_STATUS_COUNT> status_bits_;
+};
+
+inline bool IsDocumentSelected(const uint64_t* bits, int index) {
+    return bits[index / 64] >> (index % 64) & 1;
+}
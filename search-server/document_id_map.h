@@ -0,0 +1,229 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "copy_on_write.h"
+
+// Ids of the live documents and their internal indexes, sorted by id, in pages of up to PAGE_SIZE.
+// Copies share the pages and a page is copied on its first change, so a copy costs a pointer per page
+class DocumentIdMap {
+public:
+    static constexpr size_t PAGE_SIZE = 512;
+
+    // Document id and internal index
+    using Entry = std::pair<int, int>;
+
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Entry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Entry*;
+        using reference = const Entry&;
+
+        const_iterator() = default;
+
+        reference operator*() const {
+            return (*pages_[page_])[position_];
+        }
+
+        pointer operator->() const {
+            return &**this;
+        }
+
+        const_iterator& operator++() {
+            if (++position_ == pages_[page_]->size()) {
+                ++page_;
+                position_ = 0;
+            }
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator result = *this;
+            ++*this;
+            return result;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return page_ == other.page_ && position_ == other.position_;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        friend class DocumentIdMap;
+
+        const std::shared_ptr<std::vector<Entry>>* pages_ = nullptr;
+        size_t page_ = 0;
+        size_t position_ = 0;
+    };
+
+    // Walks the ids alone
+    class IdIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = int;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const int*;
+        using reference = const int&;
+
+        IdIterator() = default;
+
+        explicit IdIterator(const_iterator entry)
+            : entry_(entry) {
+        }
+
+        reference operator*() const {
+            return entry_->first;
+        }
+
+        pointer operator->() const {
+            return &entry_->first;
+        }
+
+        IdIterator& operator++() {
+            ++entry_;
+            return *this;
+        }
+
+        IdIterator operator++(int) {
+            IdIterator result = *this;
+            ++entry_;
+            return result;
+        }
+
+        bool operator==(const IdIterator& other) const {
+            return entry_ == other.entry_;
+        }
+
+        bool operator!=(const IdIterator& other) const {
+            return entry_ != other.entry_;
+        }
+
+    private:
+        const_iterator entry_;
+    };
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    const_iterator begin() const {
+        return MakeIterator(0, 0);
+    }
+
+    const_iterator end() const {
+        return MakeIterator(pages_.size(), 0);
+    }
+
+    const_iterator Find(int document_id) const {
+        const size_t page = FindPage(document_id);
+        if (page == pages_.size()) {
+            return end();
+        }
+        const std::vector<Entry>& entries = *pages_[page];
+        const auto entry = LowerBound(entries, document_id);
+        if (entry == entries.end() || entry->first != document_id) {
+            return end();
+        }
+        return MakeIterator(page, entry - entries.begin());
+    }
+
+    bool Contains(int document_id) const {
+        return Find(document_id) != end();
+    }
+
+    // Returns false and changes nothing if the id is taken
+    bool Insert(int document_id, int document_index) {
+        if (pages_.empty()) {
+            pages_.push_back(std::make_shared<std::vector<Entry>>(1, Entry{document_id, document_index}));
+            ++size_;
+            return true;
+        }
+        const size_t page = std::min(FindPage(document_id), pages_.size() - 1);
+        const auto position = LowerBound(*pages_[page], document_id);
+        if (position != pages_[page]->end() && position->first == document_id) {
+            return false;
+        }
+        const size_t offset = position - pages_[page]->begin();
+        ++size_;
+        // Ids mostly come in increasing order, a full last page is followed by a new one rather than split
+        if (pages_[page]->size() == PAGE_SIZE && page + 1 == pages_.size() && offset == PAGE_SIZE) {
+            pages_.push_back(std::make_shared<std::vector<Entry>>(1, Entry{document_id, document_index}));
+            return true;
+        }
+        std::vector<Entry>& entries = GetOwnCopy(pages_[page]);
+        entries.insert(entries.begin() + offset, {document_id, document_index});
+        if (entries.size() > PAGE_SIZE) {
+            const auto middle = entries.begin() + entries.size() / 2;
+            pages_.insert(pages_.begin() + page + 1, std::make_shared<std::vector<Entry>>(middle, entries.end()));
+            // pages_ may have moved, the entries have not
+            entries.erase(middle, entries.end());
+        }
+        return true;
+    }
+
+    void Erase(int document_id) {
+        const size_t page = FindPage(document_id);
+        if (page == pages_.size()) {
+            return;
+        }
+        const auto position = LowerBound(*pages_[page], document_id);
+        if (position == pages_[page]->end() || position->first != document_id) {
+            return;
+        }
+        const size_t offset = position - pages_[page]->begin();
+        --size_;
+        if (pages_[page]->size() == 1) {
+            pages_.erase(pages_.begin() + page);
+            return;
+        }
+        std::vector<Entry>& entries = GetOwnCopy(pages_[page]);
+        entries.erase(entries.begin() + offset);
+    }
+
+    // Moves every document to new_indexes[document_index]
+    void Renumber(const std::vector<int>& new_indexes) {
+        for (auto& page : pages_) {
+            for (Entry& entry : GetOwnCopy(page)) {
+                entry.second = new_indexes[entry.second];
+            }
+        }
+    }
+
+private:
+    std::vector<std::shared_ptr<std::vector<Entry>>> pages_;
+    size_t size_ = 0;
+
+    const_iterator MakeIterator(size_t page, size_t position) const {
+        const_iterator result;
+        result.pages_ = pages_.data();
+        result.page_ = page;
+        result.position_ = position;
+        return result;
+    }
+
+    // The page that would hold the id, pages_.size() if it is past the last one
+    size_t FindPage(int document_id) const {
+        return std::lower_bound(pages_.begin(), pages_.end(), document_id, [](const auto& page, int id) {
+                   return page->back().first < id;
+               })
+               - pages_.begin();
+    }
+
+    static std::vector<Entry>::const_iterator LowerBound(const std::vector<Entry>& entries, int document_id) {
+        return std::lower_bound(entries.begin(), entries.end(), document_id, [](const Entry& entry, int id) {
+            return entry.first < id;
+        });
+    }
+};
@@ -0,0 +1,259 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "copy_on_write.h"
+#include "posting_codec.h"
+#include "term_dictionary.h"
+
+// A term of a document and its frequency in the document
+struct TermFrequency {
+    TermId term;
+    double term_freq;
+};
+
+// Forward index: the terms of every document sorted by term id, indexed by document index.
+// Documents are kept in chunks of CHUNK_SIZE. A chunk is plain, borrows read-only terms from a loaded
+// snapshot or is compressed; a change rewrites only the chunk it touches and a compressed chunk stays compressed.
+// New documents collect in a plain chunk until the next Compress.
+// Copies of an index share their chunks, a chunk is copied on its first change
+class ForwardIndex {
+public:
+    static constexpr size_t CHUNK_SIZE = 64;
+    // Compressed terms are decoded this many at a time
+    static constexpr size_t GROUP_SIZE = 128;
+
+    // Terms of one document. Plain terms are referred to in place, compressed ones are decoded into the view
+    class Terms {
+    public:
+        Terms() = default;
+        Terms(Terms&&) = default;
+        Terms& operator=(Terms&&) = default;
+        Terms(const Terms&) = delete;
+        Terms& operator=(const Terms&) = delete;
+
+        const TermFrequency* begin() const {
+            return begin_;
+        }
+        const TermFrequency* end() const {
+            return end_;
+        }
+        size_t size() const {
+            return end_ - begin_;
+        }
+        bool empty() const {
+            return begin_ == end_;
+        }
+
+    private:
+        friend class ForwardIndex;
+
+        const TermFrequency* begin_ = nullptr;
+        const TermFrequency* end_ = nullptr;
+        std::vector<TermFrequency> decoded_;
+    };
+
+    // An index of read-only terms: the terms of document i are terms[offsets[i]] ... terms[offsets[i + 1] - 1]
+    static ForwardIndex Borrow(const TermFrequency* terms, const uint64_t* offsets, size_t document_count) {
+        ForwardIndex result;
+        for (size_t chunk_begin = 0; chunk_begin < document_count; chunk_begin += CHUNK_SIZE) {
+            const size_t chunk_end = std::min(chunk_begin + CHUNK_SIZE, document_count);
+            auto chunk = std::make_shared<Chunk>();
+            chunk->borrowed = terms + offsets[chunk_begin];
+            chunk->offsets.clear();
+            for (size_t document = chunk_begin; document <= chunk_end; ++document) {
+                chunk->offsets.push_back(offsets[document] - offsets[chunk_begin]);
+            }
+            result.chunks_.push_back(std::move(chunk));
+        }
+        result.size_ = document_count;
+        return result;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    // Appends the next document, terms must be sorted by term
+    void Add(const std::vector<TermFrequency>& terms) {
+        if (chunks_.empty() || chunks_.back()->GetDocumentCount() == CHUNK_SIZE) {
+            chunks_.push_back(std::make_shared<Chunk>());
+        } else if (!chunks_.back()->IsPlain()) {
+            chunks_.back() = MakePlain(*chunks_.back(), (chunks_.size() - 1) * CHUNK_SIZE);
+        }
+        Chunk& chunk = GetOwnCopy(chunks_.back());
+        chunk.terms.insert(chunk.terms.end(), terms.begin(), terms.end());
+        chunk.offsets.push_back(chunk.terms.size());
+        if (chunk.GetDocumentCount() == CHUNK_SIZE) {
+            chunk.terms.shrink_to_fit();
+        }
+        ++size_;
+    }
+
+    Terms Get(size_t document_index) const {
+        const Chunk& chunk = *chunks_[document_index / CHUNK_SIZE];
+        const size_t position = document_index % CHUNK_SIZE;
+        Terms result;
+        if (!chunk.IsCompressed()) {
+            const TermFrequency* terms = chunk.borrowed ? chunk.borrowed : chunk.terms.data();
+            result.begin_ = terms + chunk.offsets[position];
+            result.end_ = terms + chunk.offsets[position + 1];
+            return result;
+        }
+        const size_t term_count = chunk.offsets[position + 1] - chunk.offsets[position];
+        result.decoded_.resize(term_count);
+        Decode(chunk, document_index, result.decoded_.data());
+        result.begin_ = result.decoded_.data();
+        result.end_ = result.begin_ + term_count;
+        return result;
+    }
+
+    // Drops the terms of a removed document
+    void Clear(size_t document_index) {
+        const size_t first_document_index = document_index - document_index % CHUNK_SIZE;
+        std::shared_ptr<Chunk>& chunk_pointer = chunks_[document_index / CHUNK_SIZE];
+        const auto inv_word_counts = chunk_pointer->inv_word_counts;
+        if (!chunk_pointer->IsPlain()) {
+            chunk_pointer = MakePlain(*chunk_pointer, first_document_index);
+        }
+        Chunk& chunk = GetOwnCopy(chunk_pointer);
+        const size_t position = document_index % CHUNK_SIZE;
+        const uint32_t begin = chunk.offsets[position];
+        const uint32_t cleared = chunk.offsets[position + 1] - begin;
+        chunk.terms.erase(chunk.terms.begin() + begin, chunk.terms.begin() + begin + cleared);
+        for (size_t i = position + 1; i < chunk.offsets.size(); ++i) {
+            chunk.offsets[i] -= cleared;
+        }
+        if (inv_word_counts) {
+            chunk_pointer = CompressChunk(chunk_pointer, first_document_index, inv_word_counts);
+        }
+    }
+
+    // Keeps the listed documents only, in the order listed. The result is plain
+    void Keep(const std::vector<int>& document_indexes) {
+        ForwardIndex kept;
+        std::vector<TermFrequency> terms;
+        for (const int document_index : document_indexes) {
+            const Terms document_terms = Get(document_index);
+            terms.assign(document_terms.begin(), document_terms.end());
+            kept.Add(terms);
+        }
+        *this = std::move(kept);
+    }
+
+    // Compresses the chunks that are not, inv_word_counts holds the inverse word count of every document.
+    // A chunk with a frequency that is not a count times the inverse word count stays plain
+    void Compress(const std::shared_ptr<const std::vector<double>>& inv_word_counts) {
+        for (size_t chunk = 0; chunk < chunks_.size(); ++chunk) {
+            if (!chunks_[chunk]->IsCompressed()) {
+                chunks_[chunk] = CompressChunk(chunks_[chunk], chunk * CHUNK_SIZE, inv_word_counts);
+            }
+        }
+    }
+
+    // Whether any chunk is compressed
+    bool IsCompressed() const {
+        return std::any_of(chunks_.begin(), chunks_.end(), [](const std::shared_ptr<Chunk>& chunk) {
+            return chunk->IsCompressed();
+        });
+    }
+
+private:
+    struct Chunk {
+        // Document i of the chunk has the terms offsets[i] ... offsets[i + 1] - 1
+        std::vector<uint32_t> offsets = {0};
+        // Plain terms, owned or borrowed
+        std::vector<TermFrequency> terms;
+        const TermFrequency* borrowed = nullptr;
+        // Compressed terms of document i start at byte_offsets[i]: in groups of GROUP_SIZE, the gaps between
+        // term ids, the first one counted from 0, and then the word counts, both StreamVByte coded.
+        // A term frequency is restored as count * inv_word_counts[document_index], the very product it was computed as
+        std::vector<uint8_t> bytes;
+        std::vector<uint32_t> byte_offsets;
+        std::shared_ptr<const std::vector<double>> inv_word_counts;
+
+        size_t GetDocumentCount() const {
+            return offsets.size() - 1;
+        }
+        bool IsCompressed() const {
+            return inv_word_counts != nullptr;
+        }
+        bool IsPlain() const {
+            return !IsCompressed() && !borrowed;
+        }
+    };
+
+    std::vector<std::shared_ptr<Chunk>> chunks_;
+    size_t size_ = 0;
+
+    static void Decode(const Chunk& chunk, size_t document_index, TermFrequency* out) {
+        const size_t position = document_index % CHUNK_SIZE;
+        const size_t term_count = chunk.offsets[position + 1] - chunk.offsets[position];
+        const uint8_t* in = chunk.bytes.data() + chunk.byte_offsets[position];
+        const double inv_word_count = (*chunk.inv_word_counts)[document_index];
+        std::array<uint32_t, GROUP_SIZE> gaps;
+        std::array<uint32_t, GROUP_SIZE> counts;
+        TermId term = 0;
+        for (size_t group_begin = 0; group_begin < term_count; group_begin += GROUP_SIZE) {
+            const size_t group_size = std::min(GROUP_SIZE, term_count - group_begin);
+            in = DecodeStreamVByte(in, group_size, gaps.data());
+            in = DecodeStreamVByte(in, group_size, counts.data());
+            for (size_t i = 0; i < group_size; ++i) {
+                term += gaps[i];
+                out[group_begin + i] = {term, counts[i] * inv_word_count};
+            }
+        }
+    }
+
+    static std::shared_ptr<Chunk> MakePlain(const Chunk& chunk, size_t first_document_index) {
+        auto result = std::make_shared<Chunk>();
+        result->offsets = chunk.offsets;
+        if (chunk.borrowed) {
+            result->terms.assign(chunk.borrowed, chunk.borrowed + chunk.offsets.back());
+            return result;
+        }
+        result->terms.resize(chunk.offsets.back());
+        for (size_t position = 0; position < chunk.GetDocumentCount(); ++position) {
+            Decode(chunk, first_document_index + position, result->terms.data() + chunk.offsets[position]);
+        }
+        return result;
+    }
+
+    // A compressed copy of the chunk, or the chunk itself if a frequency is not a count times the inverse word count
+    static std::shared_ptr<Chunk> CompressChunk(const std::shared_ptr<Chunk>& chunk_pointer, size_t first_document_index,
+                                                const std::shared_ptr<const std::vector<double>>& inv_word_counts) {
+        const Chunk& chunk = *chunk_pointer;
+        const TermFrequency* terms = chunk.borrowed ? chunk.borrowed : chunk.terms.data();
+        auto result = std::make_shared<Chunk>();
+        result->offsets = chunk.offsets;
+        std::array<uint32_t, GROUP_SIZE> gaps;
+        std::array<uint32_t, GROUP_SIZE> counts;
+        for (size_t position = 0; position < chunk.GetDocumentCount(); ++position) {
+            const double inv_word_count = (*inv_word_counts)[first_document_index + position];
+            result->byte_offsets.push_back(result->bytes.size());
+            TermId previous_term = 0;
+            for (uint32_t group_begin = chunk.offsets[position]; group_begin < chunk.offsets[position + 1]; group_begin += GROUP_SIZE) {
+                const size_t group_size = std::min<size_t>(GROUP_SIZE, chunk.offsets[position + 1] - group_begin);
+                for (size_t i = 0; i < group_size; ++i) {
+                    const TermFrequency& term = terms[group_begin + i];
+                    counts[i] = std::lround(term.term_freq / inv_word_count);
+                    if (counts[i] * inv_word_count != term.term_freq) {
+                        return chunk_pointer;
+                    }
+                    gaps[i] = term.term - previous_term;
+                    previous_term = term.term;
+                }
+                EncodeStreamVByte(gaps.data(), group_size, result->bytes);
+                EncodeStreamVByte(counts.data(), group_size, result->bytes);
+            }
+        }
+        result->bytes.resize(result->bytes.size() + STREAM_VBYTE_PADDING);
+        result->bytes.shrink_to_fit();
+        result->inv_word_counts = inv_word_counts;
+        return result;
+    }
+};
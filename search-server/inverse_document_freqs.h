@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "term_dictionary.h"
+
+// Lazily computed log(document_count / document_freq) per term.
+// Every entry is stamped with the epoch it was computed in and every index change starts
+// a new epoch, so stale values are recomputed on first use. Concurrent const readers are safe:
+// they may only race to store the same value.
+// A frozen table keeps its values no matter how the index changes afterwards.
+class InverseDocumentFreqs {
+public:
+    void Resize(size_t term_count) {
+        if (entries_.size() < term_count) {
+            entries_.resize(term_count);
+        }
+    }
+
+    // Forgets the value of a term id that starts to denote a new word
+    void Reset(TermId term) {
+        entries_[term].epoch.store(0, std::memory_order_relaxed);
+    }
+
+    void Invalidate() {
+        if (!frozen_) {
+            ++epoch_;
+        }
+    }
+
+    double Get(TermId term, size_t document_count, size_t document_freq) const {
+        const Entry& entry = entries_[term];
+        if (entry.epoch.load(std::memory_order_acquire) == epoch_) {
+            return entry.value.load(std::memory_order_relaxed);
+        }
+        const double value = std::log(document_count * 1.0 / document_freq);
+        entry.value.store(value, std::memory_order_relaxed);
+        entry.epoch.store(epoch_, std::memory_order_release);
+        return value;
+    }
+
+    // Pins a value, used for frozen tables restored from a snapshot
+    void Set(TermId term, double value) {
+        entries_[term].value.store(value, std::memory_order_relaxed);
+        entries_[term].epoch.store(epoch_, std::memory_order_relaxed);
+    }
+
+    void Freeze() {
+        frozen_ = true;
+    }
+
+    void Unfreeze() {
+        frozen_ = false;
+        ++epoch_;
+    }
+
+    bool IsFrozen() const {
+        return frozen_;
+    }
+
+private:
+    struct Entry {
+        mutable std::atomic<double> value{0.0};
+        mutable std::atomic<uint64_t> epoch{0};
+
+        Entry() = default;
+        Entry(const Entry& other)
+            : value(other.value.load(std::memory_order_relaxed))
+            , epoch(other.epoch.load(std::memory_order_relaxed)) {
+        }
+    };
+
+    std::vector<Entry> entries_;
+    uint64_t epoch_ = 1;
+    bool frozen_ = false;
+};
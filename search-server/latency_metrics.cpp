@@ -0,0 +1,150 @@
+#include "latency_metrics.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+using namespace std::string_literals;
+
+namespace {
+
+const std::array<std::string_view, ThreadMetrics::STAGE_COUNT> STAGE_NAMES = {
+    "find_top_documents", "match_document", "match_documents", "add_document", "remove_document",
+    "parse_query", "weigh_query", "score_postings", "select_top_documents",
+};
+const std::array<std::string_view, ThreadMetrics::COUNTER_COUNT> COUNTER_NAMES = {
+    "postings_scanned", "documents_scored",
+};
+
+// Blocks are never freed: a finished thread leaves its block to the next new one, so the counts stay
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadMetrics>> blocks;
+    std::vector<ThreadMetrics*> free_blocks;
+};
+
+Registry& GetRegistry() {
+    // Threads may end after static destruction, so the registry is never destroyed
+    static Registry* registry = new Registry;
+    return *registry;
+}
+
+class ThreadSlot {
+public:
+    ThreadSlot() {
+        Registry& registry = GetRegistry();
+        std::lock_guard guard(registry.mutex);
+        if (registry.free_blocks.empty()) {
+            metrics_ = registry.blocks.emplace_back(std::make_unique<ThreadMetrics>()).get();
+        } else {
+            metrics_ = registry.free_blocks.back();
+            registry.free_blocks.pop_back();
+        }
+    }
+
+    ~ThreadSlot() {
+        Registry& registry = GetRegistry();
+        std::lock_guard guard(registry.mutex);
+        registry.free_blocks.push_back(metrics_);
+    }
+
+    ThreadMetrics& Get() const {
+        return *metrics_;
+    }
+
+private:
+    ThreadMetrics* metrics_;
+};
+
+// The smallest recorded value at or above the quantile, up to the bucket width
+uint64_t ComputePercentile(const std::array<uint64_t, LatencyBuckets::COUNT>& buckets, uint64_t count, double quantile, uint64_t max_ns) {
+    if (count == 0) {
+        return 0;
+    }
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(quantile * count + 0.5));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+        seen += buckets[bucket];
+        if (seen >= rank) {
+            return std::min(LatencyBuckets::UpperBound(bucket), max_ns);
+        }
+    }
+    return max_ns;
+}
+
+}
+
+ThreadMetrics& ThreadMetrics::Get() {
+    thread_local ThreadSlot slot;
+    return slot.Get();
+}
+
+MetricsSnapshot GetMetricsSnapshot() {
+    MetricsSnapshot snapshot;
+    Registry& registry = GetRegistry();
+    std::lock_guard guard(registry.mutex);
+    for (size_t stage = 0; stage < ThreadMetrics::STAGE_COUNT; ++stage) {
+        std::array<uint64_t, LatencyBuckets::COUNT> buckets{};
+        LatencySummary summary;
+        summary.stage = STAGE_NAMES[stage];
+        for (const auto& block : registry.blocks) {
+            const auto& data = block->stages_[stage];
+            for (size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+                const uint64_t count = data.buckets[bucket].load(std::memory_order_relaxed);
+                buckets[bucket] += count;
+                summary.count += count;
+            }
+            summary.total_ns += data.total_ns.load(std::memory_order_relaxed);
+            summary.max_ns = std::max(summary.max_ns, data.max_ns.load(std::memory_order_relaxed));
+        }
+        summary.p50_ns = ComputePercentile(buckets, summary.count, 0.5, summary.max_ns);
+        summary.p99_ns = ComputePercentile(buckets, summary.count, 0.99, summary.max_ns);
+        summary.p999_ns = ComputePercentile(buckets, summary.count, 0.999, summary.max_ns);
+        snapshot.latencies.push_back(summary);
+    }
+    for (size_t counter = 0; counter < ThreadMetrics::COUNTER_COUNT; ++counter) {
+        uint64_t value = 0;
+        for (const auto& block : registry.blocks) {
+            value += block->counters_[counter].load(std::memory_order_relaxed);
+        }
+        snapshot.counters.emplace_back(COUNTER_NAMES[counter], value);
+    }
+    return snapshot;
+}
+
+std::string MetricsSnapshot::ToJson() const {
+    std::ostringstream out;
+    out << "{\"latencies\":{"s;
+    for (size_t i = 0; i < latencies.size(); ++i) {
+        const LatencySummary& summary = latencies[i];
+        out << (i > 0 ? ","s : ""s) << '"' << summary.stage << "\":{\"count\":"s << summary.count
+            << ",\"total_ns\":"s << summary.total_ns << ",\"p50_ns\":"s << summary.p50_ns << ",\"p99_ns\":"s << summary.p99_ns
+            << ",\"p999_ns\":"s << summary.p999_ns << ",\"max_ns\":"s << summary.max_ns << '}';
+    }
+    out << "},\"counters\":{"s;
+    for (size_t i = 0; i < counters.size(); ++i) {
+        out << (i > 0 ? ","s : ""s) << '"' << counters[i].first << "\":"s << counters[i].second;
+    }
+    out << "}}"s;
+    return out.str();
+}
+
+std::string MetricsSnapshot::ToPrometheus() const {
+    std::ostringstream out;
+    out << "# HELP search_server_latency_seconds Latency of search server operations and search stages\n"s;
+    out << "# TYPE search_server_latency_seconds summary\n"s;
+    for (const LatencySummary& summary : latencies) {
+        const std::pair<std::string_view, uint64_t> quantiles[] = {{"0.5", summary.p50_ns}, {"0.99", summary.p99_ns}, {"0.999", summary.p999_ns}};
+        for (const auto& [quantile, nanoseconds] : quantiles) {
+            out << "search_server_latency_seconds{stage=\""s << summary.stage << "\",quantile=\""s << quantile << "\"} "s
+                << nanoseconds * 1e-9 << '\n';
+        }
+        out << "search_server_latency_seconds_sum{stage=\""s << summary.stage << "\"} "s << summary.total_ns * 1e-9 << '\n';
+        out << "search_server_latency_seconds_count{stage=\""s << summary.stage << "\"} "s << summary.count << '\n';
+    }
+    for (const auto& [name, value] : counters) {
+        out << "# TYPE search_server_"s << name << "_total counter\n"s;
+        out << "search_server_"s << name << "_total "s << value << '\n';
+    }
+    return out.str();
+}
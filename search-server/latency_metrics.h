@@ -0,0 +1,169 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Latency histograms and work counters of the search server.
+// Recording is compiled in only with -DSEARCH_SERVER_METRICS, otherwise the SEARCH_METRICS_ macros
+// expand to nothing and snapshots stay empty.
+// Every thread records into a block of its own with plain relaxed stores, no locks and no shared
+// cache lines; a snapshot sums the blocks of all threads, including finished ones
+
+enum class LatencyStage {
+    FIND_TOP_DOCUMENTS,
+    MATCH_DOCUMENT,
+    // A whole MatchDocuments batch
+    MATCH_DOCUMENTS,
+    ADD_DOCUMENT,
+    REMOVE_DOCUMENT,
+    // Parts of a search
+    PARSE_QUERY,
+    WEIGH_QUERY,
+    SCORE_POSTINGS,
+    // Top-K selection and building the result
+    SELECT_TOP_DOCUMENTS,
+};
+
+enum class WorkCounter {
+    POSTINGS_SCANNED,
+    DOCUMENTS_SCORED,
+};
+
+struct LatencySummary {
+    std::string_view stage;
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t p50_ns = 0;
+    uint64_t p99_ns = 0;
+    uint64_t p999_ns = 0;
+    uint64_t max_ns = 0;
+};
+
+struct MetricsSnapshot {
+    std::vector<LatencySummary> latencies;
+    std::vector<std::pair<std::string_view, uint64_t>> counters;
+
+    std::string ToJson() const;
+    // Prometheus text exposition format, latencies as summaries in seconds
+    std::string ToPrometheus() const;
+};
+
+MetricsSnapshot GetMetricsSnapshot();
+
+// Log-linear buckets like HdrHistogram: every power of two is split into SUB_BUCKET_COUNT buckets,
+// so a percentile is off by less than 1 / SUB_BUCKET_COUNT. Longer than 2^MAX_EXPONENT ns (~18 min) counts as that
+struct LatencyBuckets {
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr uint64_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static constexpr int MAX_EXPONENT = 40;
+    static constexpr size_t COUNT = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKET_COUNT;
+
+    static size_t Of(uint64_t nanoseconds) {
+        if (nanoseconds < SUB_BUCKET_COUNT) {
+            return nanoseconds;
+        }
+#ifdef __GNUC__
+        const int exponent = 63 - __builtin_clzll(nanoseconds);
+#else
+        int exponent = SUB_BUCKET_BITS;
+        while (nanoseconds >> (exponent + 1)) {
+            ++exponent;
+        }
+#endif
+        if (exponent > MAX_EXPONENT) {
+            return COUNT - 1;
+        }
+        const uint64_t sub_bucket = (nanoseconds >> (exponent - SUB_BUCKET_BITS)) - SUB_BUCKET_COUNT;
+        return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT + sub_bucket;
+    }
+
+    // The largest value of the bucket
+    static uint64_t UpperBound(size_t bucket) {
+        if (bucket < SUB_BUCKET_COUNT) {
+            return bucket;
+        }
+        const int shift = static_cast<int>(bucket / SUB_BUCKET_COUNT) - 1;
+        return ((SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT + 1) << shift) - 1;
+    }
+};
+
+class ThreadMetrics {
+public:
+    static constexpr size_t STAGE_COUNT = static_cast<size_t>(LatencyStage::SELECT_TOP_DOCUMENTS) + 1;
+    static constexpr size_t COUNTER_COUNT = static_cast<size_t>(WorkCounter::DOCUMENTS_SCORED) + 1;
+
+    // The block of the calling thread
+    static ThreadMetrics& Get();
+
+    void RecordLatency(LatencyStage stage, uint64_t nanoseconds) {
+        Stage& data = stages_[static_cast<size_t>(stage)];
+        Increase(data.buckets[LatencyBuckets::Of(nanoseconds)], 1);
+        Increase(data.total_ns, nanoseconds);
+        if (nanoseconds > data.max_ns.load(std::memory_order_relaxed)) {
+            data.max_ns.store(nanoseconds, std::memory_order_relaxed);
+        }
+    }
+
+    void Count(WorkCounter counter, uint64_t value) {
+        Increase(counters_[static_cast<size_t>(counter)], value);
+    }
+
+private:
+    friend MetricsSnapshot GetMetricsSnapshot();
+
+    struct Stage {
+        std::array<std::atomic<uint64_t>, LatencyBuckets::COUNT> buckets{};
+        std::atomic<uint64_t> total_ns{0};
+        std::atomic<uint64_t> max_ns{0};
+    };
+
+    // Cache lines of two threads never overlap
+    alignas(64) std::array<Stage, STAGE_COUNT> stages_{};
+    std::array<std::atomic<uint64_t>, COUNTER_COUNT> counters_{};
+
+    // Only the owning thread writes, so no read-modify-write is needed
+    static void Increase(std::atomic<uint64_t>& value, uint64_t delta) {
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+};
+
+// Records the time from construction to destruction
+class LatencyTimer {
+public:
+    explicit LatencyTimer(LatencyStage stage)
+        : stage_(stage) {
+    }
+
+    ~LatencyTimer() {
+        const auto duration = std::chrono::steady_clock::now() - start_time_;
+        ThreadMetrics::Get().RecordLatency(stage_, std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+    }
+
+    LatencyTimer(const LatencyTimer&) = delete;
+    LatencyTimer& operator=(const LatencyTimer&) = delete;
+
+private:
+    const LatencyStage stage_;
+    const std::chrono::steady_clock::time_point start_time_ = std::chrono::steady_clock::now();
+};
+
+#define SEARCH_METRICS_CONCAT_INTERNAL(X, Y) X##Y
+#define SEARCH_METRICS_CONCAT(X, Y) SEARCH_METRICS_CONCAT_INTERNAL(X, Y)
+
+// SEARCH_METRICS_TIME times the rest of the scope, SEARCH_METRICS_START a stage that ends at SEARCH_METRICS_STOP
+#ifdef SEARCH_SERVER_METRICS
+#define SEARCH_METRICS_TIME(stage) LatencyTimer SEARCH_METRICS_CONCAT(latency_timer, __LINE__)(LatencyStage::stage)
+#define SEARCH_METRICS_START(timer, stage) std::optional<LatencyTimer> timer(std::in_place, LatencyStage::stage)
+#define SEARCH_METRICS_STOP(timer) timer.reset()
+#define SEARCH_METRICS_COUNT(counter, value) ThreadMetrics::Get().Count(WorkCounter::counter, value)
+#else
+#define SEARCH_METRICS_TIME(stage)
+#define SEARCH_METRICS_START(timer, stage)
+#define SEARCH_METRICS_STOP(timer)
+#define SEARCH_METRICS_COUNT(counter, value)
+#endif
@@ -1,6 +1,8 @@
 #pragma once
 #include <chrono>
 #include <iostream>
+#include <string>
+#include <string_view>
  
 #define PROFILE_CONCAT_INTERNAL(X, Y) X##Y
 #define PROFILE_CONCAT(X, Y) PROFILE_CONCAT_INTERNAL(X, Y)
@@ -11,14 +13,15 @@
 class LogDuration {
 public:
     using Clock = std::chrono::steady_clock;
-    LogDuration(const std::string& id, std::ostream& out = std::cerr) : id_(id), out_(out) {}
+    LogDuration(std::string_view id, std::ostream& out = std::cerr) : id_(id), out_(out) {}
     ~LogDuration() {
         using namespace std::chrono;
         using namespace std::literals;
  
         const auto end_time = Clock::now();
         const auto dur = end_time - start_time_;
-        out_ << id_ << ": "s << duration_cast<milliseconds>(dur).count() << " ms"s << std::endl;
+        // Fractions of a millisecond matter for single queries, see latency_metrics.h for distributions
+        out_ << id_ << ": "s << duration<double, std::milli>(dur).count() << " ms"s << std::endl;
     }
 private:
     const std::string id_;
@@ -0,0 +1,126 @@
+#include "posting_codec.h"
+#include <array>
+#include <cstring>
+// The SSSE3 kernel is compiled for that target on its own and chosen at run time,
+// so a baseline x86-64 build still decodes with a shuffle where the CPU has one
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STREAM_VBYTE_SSSE3
+#include <tmmintrin.h>
+#endif
+
+namespace {
+
+size_t GetByteCount(uint32_t value) {
+    return value < (1u << 8) ? 1 : value < (1u << 16) ? 2 : value < (1u << 24) ? 3 : 4;
+}
+
+// For every control byte: where each of its four values starts in the data, how many data bytes
+// it covers in total and, for SSSE3, the shuffle that spreads them over four 32-bit lanes
+struct ControlTables {
+    std::array<std::array<uint8_t, 4>, 256> offsets;
+    std::array<uint8_t, 256> lengths;
+    std::array<std::array<uint8_t, 16>, 256> shuffles;
+};
+
+ControlTables BuildControlTables() {
+    ControlTables tables;
+    for (size_t control = 0; control < 256; ++control) {
+        uint8_t source = 0;
+        for (size_t lane = 0; lane < 4; ++lane) {
+            const size_t byte_count = ((control >> (2 * lane)) & 3) + 1;
+            tables.offsets[control][lane] = source;
+            for (size_t byte = 0; byte < 4; ++byte) {
+                // A set high bit makes the shuffle write zero
+                tables.shuffles[control][lane * 4 + byte] = byte < byte_count ? source++ : 0x80;
+            }
+        }
+        tables.lengths[control] = source;
+    }
+    return tables;
+}
+
+const ControlTables CONTROL_TABLES = BuildControlTables();
+
+const uint32_t BYTE_MASKS[4] = {0xFF, 0xFFFF, 0xFFFFFF, 0xFFFFFFFF};
+
+uint32_t LoadValue(const uint8_t* data, size_t byte_count) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value & BYTE_MASKS[byte_count - 1];
+}
+
+// Decodes group_count groups of four values, returns the position after their data bytes.
+// Every group loads whole words past its own bytes, STREAM_VBYTE_PADDING keeps that in bounds
+const uint8_t* DecodeGroupsScalar(const uint8_t* controls, const uint8_t* data, size_t group_count, uint32_t* values) {
+    for (size_t group = 0; group < group_count; ++group, values += 4) {
+        const uint8_t control = controls[group];
+        const auto& offsets = CONTROL_TABLES.offsets[control];
+        for (size_t lane = 0; lane < 4; ++lane) {
+            values[lane] = LoadValue(data + offsets[lane], ((control >> (2 * lane)) & 3) + 1);
+        }
+        data += CONTROL_TABLES.lengths[control];
+    }
+    return data;
+}
+
+#ifdef STREAM_VBYTE_SSSE3
+__attribute__((target("ssse3")))
+const uint8_t* DecodeGroupsSsse3(const uint8_t* controls, const uint8_t* data, size_t group_count, uint32_t* values) {
+    for (size_t group = 0; group < group_count; ++group, values += 4) {
+        const uint8_t control = controls[group];
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+        const __m128i shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(CONTROL_TABLES.shuffles[control].data()));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values), _mm_shuffle_epi8(bytes, shuffle));
+        data += CONTROL_TABLES.lengths[control];
+    }
+    return data;
+}
+#endif
+
+using DecodeGroups = const uint8_t* (*)(const uint8_t* controls, const uint8_t* data, size_t group_count, uint32_t* values);
+
+DecodeGroups SelectDecodeGroups() {
+#if defined(__SSSE3__)
+    return DecodeGroupsSsse3;
+#elif defined(STREAM_VBYTE_SSSE3)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3") ? DecodeGroupsSsse3 : DecodeGroupsScalar;
+#else
+    return DecodeGroupsScalar;
+#endif
+}
+
+const DecodeGroups DECODE_GROUPS = SelectDecodeGroups();
+
+const uint8_t* DecodeStreamVByteWith(DecodeGroups decode_groups, const uint8_t* in, size_t count, uint32_t* values) {
+    const size_t group_count = count / 4;
+    const uint8_t* data = decode_groups(in, in + (count + 3) / 4, group_count, values);
+    for (size_t i = group_count * 4; i < count; ++i) {
+        const size_t byte_count = ((in[i / 4] >> (2 * (i % 4))) & 3) + 1;
+        values[i] = LoadValue(data, byte_count);
+        data += byte_count;
+    }
+    return data;
+}
+
+}  // namespace
+
+void EncodeStreamVByte(const uint32_t* values, size_t count, std::vector<uint8_t>& out) {
+    const size_t control_offset = out.size();
+    out.resize(out.size() + (count + 3) / 4, 0);
+    for (size_t i = 0; i < count; ++i) {
+        const size_t byte_count = GetByteCount(values[i]);
+        out[control_offset + i / 4] |= (byte_count - 1) << (2 * (i % 4));
+        for (size_t byte = 0; byte < byte_count; ++byte) {
+            out.push_back(static_cast<uint8_t>(values[i] >> (8 * byte)));
+        }
+    }
+}
+
+const uint8_t* DecodeStreamVByte(const uint8_t* in, size_t count, uint32_t* values) {
+    return DecodeStreamVByteWith(DECODE_GROUPS, in, count, values);
+}
+
+const uint8_t* DecodeStreamVByteScalar(const uint8_t* in, size_t count, uint32_t* values) {
+    return DecodeStreamVByteWith(DecodeGroupsScalar, in, count, values);
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// StreamVByte integer coding: every value takes 1 to 4 bytes and the lengths of four values
+// share one control byte. All control bytes of a run come first, then the data bytes, so the
+// decoder expands four values with a single shuffle. The SSSE3 shuffle is used when the CPU
+// has it, whatever the build flags; otherwise four table-driven loads produce the same values.
+
+const size_t STREAM_VBYTE_PADDING = 16;
+
+// Appends the encoding of count values to out
+void EncodeStreamVByte(const uint32_t* values, size_t count, std::vector<uint8_t>& out);
+
+// Decodes count values written by EncodeStreamVByte, returns the position after them.
+// The buffer must stay readable for STREAM_VBYTE_PADDING bytes past the encoded values
+const uint8_t* DecodeStreamVByte(const uint8_t* in, size_t count, uint32_t* values);
+
+// Decodes like DecodeStreamVByte, always with the table-driven loads, so the kernels can be checked against each other
+const uint8_t* DecodeStreamVByteScalar(const uint8_t* in, size_t count, uint32_t* values);
@@ -0,0 +1,523 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <vector>
+#include "copy_on_write.h"
+#include "posting_codec.h"
+
+// One entry of an inverted index list: internal (dense) document index and term frequency
+struct Posting {
+    int document_index;
+    double term_freq;
+};
+
+// Last document index and largest term frequency of a block of postings, the bounds a block is
+// searched by. Snapshots store them, so a borrowed list is set up without reading its postings
+struct PostingBlockBounds {
+    int last_document_index;
+    double max_term_freq;
+};
+
+// Postings of a single word sorted by document index, in blocks.
+// Document indexes are handed out in increasing order, so a freshly added document
+// always lands in the last block and the list stays sorted without any reordering.
+// A block is plain, borrows read-only postings from a loaded snapshot or is compressed.
+// Changes are block-local: they rewrite the one block they touch and leave the others as they are,
+// a compressed block stays compressed. New postings collect in plain blocks until the next Compress.
+// Every block knows its largest term frequency, a score bound for pruning.
+// Copies of a list share its blocks, the block table and a block are copied on their first change
+class PostingList {
+public:
+    // Largest compressed block
+    static constexpr size_t BLOCK_SIZE = 128;
+    // Largest plain block. Plain postings are walked fastest when contiguous, a change copies one block at most
+    static constexpr size_t PLAIN_BLOCK_SIZE = 1024;
+    // Shorter lists stay plain, the block table and the shared state would take most of the saving
+    static constexpr size_t MIN_COMPRESSED_SIZE = 16;
+
+    struct Block {
+        int last_document_index = 0;
+        uint32_t size = 0;
+        double max_term_freq = 0.0;
+        // Plain postings, owned or borrowed
+        std::shared_ptr<std::vector<Posting>> postings;
+        const Posting* borrowed = nullptr;
+        // Compressed postings: the gaps between document indexes, the first one counted from 0, and then
+        // the word counts, both StreamVByte coded. A term frequency is restored as
+        // count * inv_word_counts[document_index], the very product it was computed as
+        std::shared_ptr<const std::vector<uint8_t>> bytes;
+        std::shared_ptr<const std::vector<double>> inv_word_counts;
+
+        bool IsCompressed() const {
+            return bytes != nullptr;
+        }
+    };
+
+    struct Sentinel {};
+
+    // Walks plain blocks directly and compressed blocks one decoded block at a time
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Posting;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Posting*;
+        using reference = const Posting&;
+
+        const_iterator() = default;
+
+        const_iterator(const const_iterator& other) {
+            *this = other;
+        }
+
+        // A decoded block is copied, so the copy walks on independently
+        const_iterator& operator=(const const_iterator& other) {
+            blocks_ = other.blocks_;
+            block_count_ = other.block_count_;
+            block_ = other.block_;
+            peeked_block_ = other.peeked_block_;
+            if (other.block_begin_ == other.buffer_.data()) {
+                std::copy(other.block_begin_, other.block_end_, buffer_.begin());
+                block_begin_ = buffer_.data();
+            } else {
+                block_begin_ = other.block_begin_;
+            }
+            current_ = block_begin_ + (other.current_ - other.block_begin_);
+            block_end_ = block_begin_ + (other.block_end_ - other.block_begin_);
+            return *this;
+        }
+
+        reference operator*() const {
+            return *current_;
+        }
+
+        pointer operator->() const {
+            return current_;
+        }
+
+        const_iterator& operator++() {
+            if (++current_ == block_end_) {
+                LoadBlock(block_ + 1);
+            }
+            return *this;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return block_ == other.block_ && current_ - block_begin_ == other.current_ - other.block_begin_;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+
+        bool operator==(Sentinel) const {
+            return current_ == block_end_;
+        }
+
+        bool operator!=(Sentinel) const {
+            return current_ != block_end_;
+        }
+
+        // Moves to the first posting at or after document_index. Blocks that end before document_index
+        // are skipped without decoding, the block it lands in is galloped through
+        void SkipTo(int document_index) {
+            if (current_ == block_end_ || current_->document_index >= document_index) {
+                return;
+            }
+            if (blocks_[block_].last_document_index < document_index) {
+                const Block* block = std::lower_bound(blocks_ + block_ + 1, blocks_ + block_count_, document_index,
+                                                      [](const Block& block, int index) {
+                                                          return block.last_document_index < index;
+                                                      });
+                LoadBlock(block - blocks_);
+                if (current_ == block_end_) {
+                    return;
+                }
+            }
+            size_t step = 1;
+            while (static_cast<size_t>(block_end_ - current_) > step && current_[step].document_index < document_index) {
+                current_ += step;
+                step *= 2;
+            }
+            const Posting* bound = static_cast<size_t>(block_end_ - current_) > step ? current_ + step + 1 : block_end_;
+            current_ = std::lower_bound(current_, bound, document_index, [](const Posting& posting, int index) {
+                return posting.document_index < index;
+            });
+        }
+
+        // The block that would hold document_index, looked up in the block table without decoding anything,
+        // nullptr past the last block. document_index must not decrease from call to call
+        const Block* PeekBlock(int document_index) {
+            peeked_block_ = std::max(peeked_block_, block_);
+            while (peeked_block_ < block_count_ && blocks_[peeked_block_].last_document_index < document_index) {
+                ++peeked_block_;
+            }
+            return peeked_block_ < block_count_ ? blocks_ + peeked_block_ : nullptr;
+        }
+
+    private:
+        friend class PostingList;
+
+        const Block* blocks_ = nullptr;
+        size_t block_count_ = 0;
+        size_t block_ = 0;
+        size_t peeked_block_ = 0;
+        const Posting* block_begin_ = nullptr;
+        const Posting* current_ = nullptr;
+        const Posting* block_end_ = nullptr;
+        std::array<Posting, BLOCK_SIZE> buffer_;
+
+        void LoadBlock(size_t block) {
+            block_ = block;
+            if (block < block_count_ && !blocks_[block].IsCompressed()) {
+                block_begin_ = GetPlain(blocks_[block]);
+                current_ = block_begin_;
+                block_end_ = block_begin_ + blocks_[block].size;
+                return;
+            }
+            block_begin_ = buffer_.data();
+            current_ = block_begin_;
+            block_end_ = block < block_count_ ? block_begin_ + DecodeBlock(blocks_[block], buffer_.data()) : block_begin_;
+        }
+    };
+
+    PostingList() = default;
+
+    // A list of read-only postings split into blocks of BLOCK_SIZE, bounds holds the bounds of every block
+    static PostingList Borrow(const Posting* postings, size_t size, const PostingBlockBounds* bounds) {
+        PostingList result;
+        std::vector<Block>& blocks = GetOwnCopy(result.blocks_);
+        for (size_t block_begin = 0; block_begin < size; block_begin += BLOCK_SIZE) {
+            Block& block = blocks.emplace_back();
+            block.borrowed = postings + block_begin;
+            block.size = std::min(BLOCK_SIZE, size - block_begin);
+            block.last_document_index = bounds->last_document_index;
+            block.max_term_freq = bounds->max_term_freq;
+            ++bounds;
+        }
+        result.size_ = size;
+        result.UpdateMaxTermFreq();
+        return result;
+    }
+
+    void Add(int document_index, double term_freq) {
+        max_term_freq_ = std::max(max_term_freq_, term_freq);
+        std::vector<Block>& blocks = GetOwnCopy(blocks_);
+        if (!blocks.empty() && blocks.back().last_document_index >= document_index) {
+            const size_t block = FindBlock(document_index);
+            std::vector<Posting> postings = GetPostings(blocks[block]);
+            const auto position = std::lower_bound(postings.begin(), postings.end(), document_index, [](const Posting& posting, int index) {
+                return posting.document_index < index;
+            });
+            if (position != postings.end() && position->document_index == document_index) {
+                position->term_freq += term_freq;
+                max_term_freq_ = std::max(max_term_freq_, position->term_freq);
+            } else {
+                postings.insert(position, {document_index, term_freq});
+                ++size_;
+            }
+            ReplaceBlock(block, std::move(postings));
+            return;
+        }
+        // Compressed and borrowed blocks are left alone, a full block is not grown
+        if (blocks.empty() || blocks.back().IsCompressed() || blocks.back().borrowed || blocks.back().size == PLAIN_BLOCK_SIZE) {
+            blocks.emplace_back();
+        }
+        Block& block = blocks.back();
+        GetOwnCopy(block.postings).push_back({document_index, term_freq});
+        block.last_document_index = document_index;
+        block.max_term_freq = std::max(block.max_term_freq, term_freq);
+        ++block.size;
+        ++size_;
+    }
+
+    bool Erase(int document_index) {
+        const size_t block = FindBlock(document_index);
+        if (block == GetBlocks().size()) {
+            return false;
+        }
+        std::vector<Posting> postings = GetPostings(GetBlocks()[block]);
+        const auto position = std::lower_bound(postings.begin(), postings.end(), document_index, [](const Posting& posting, int index) {
+            return posting.document_index < index;
+        });
+        if (position == postings.end() || position->document_index != document_index) {
+            return false;
+        }
+        postings.erase(position);
+        --size_;
+        ReplaceBlock(block, std::move(postings));
+        UpdateMaxTermFreq();
+        return true;
+    }
+
+    // Removes all listed documents in one pass, document_indexes must be sorted. Only the blocks holding them are rewritten
+    void Erase(const std::vector<int>& document_indexes) {
+        if (!blocks_) {
+            return;
+        }
+        auto removed = document_indexes.begin();
+        std::vector<Block>& blocks = GetOwnCopy(blocks_);
+        for (size_t block = 0; block < blocks.size() && removed != document_indexes.end();) {
+            removed = std::lower_bound(removed, document_indexes.end(), block > 0 ? blocks[block - 1].last_document_index + 1 : 0);
+            if (removed == document_indexes.end() || *removed > blocks[block].last_document_index) {
+                ++block;
+                continue;
+            }
+            std::vector<Posting> postings = GetPostings(blocks[block]);
+            auto kept = postings.begin();
+            for (const Posting& posting : postings) {
+                while (removed != document_indexes.end() && *removed < posting.document_index) {
+                    ++removed;
+                }
+                if (removed == document_indexes.end() || *removed != posting.document_index) {
+                    *kept++ = posting;
+                }
+            }
+            size_ -= postings.end() - kept;
+            postings.erase(kept, postings.end());
+            // A block left empty disappears, the next one moves into its place
+            const bool emptied = postings.empty();
+            ReplaceBlock(block, std::move(postings));
+            if (!emptied) {
+                ++block;
+            }
+        }
+        UpdateMaxTermFreq();
+    }
+
+    // Moves every posting to document new_indexes[document_index]. The mapping must keep the order of the listed documents.
+    // The list comes out plain
+    void Renumber(const std::vector<int>& new_indexes) {
+        std::vector<Posting> postings;
+        postings.reserve(size_);
+        for (const Posting& posting : *this) {
+            postings.push_back({new_indexes[posting.document_index], posting.term_freq});
+        }
+        auto blocks = std::make_shared<std::vector<Block>>();
+        for (size_t block_begin = 0; block_begin < postings.size(); block_begin += PLAIN_BLOCK_SIZE) {
+            const auto block_end = postings.begin() + std::min(block_begin + PLAIN_BLOCK_SIZE, postings.size());
+            Block block;
+            block.postings = std::make_shared<std::vector<Posting>>(postings.begin() + block_begin, block_end);
+            block.size = block.postings->size();
+            blocks->push_back(UpdateBlockBounds(std::move(block)));
+        }
+        blocks_ = std::move(blocks);
+    }
+
+    // Moves the plain postings into compressed blocks, inv_word_counts holds the inverse word count of
+    // every document. Blocks compressed before stay as they are. Lists shorter than MIN_COMPRESSED_SIZE,
+    // and blocks with a frequency that is not a count times the inverse word count, stay plain
+    void Compress(const std::shared_ptr<const std::vector<double>>& inv_word_counts) {
+        if (size_ < MIN_COMPRESSED_SIZE) {
+            if (!blocks_) {
+                return;
+            }
+            for (Block& block : GetOwnCopy(blocks_)) {
+                if (block.postings && block.postings->capacity() > block.size) {
+                    GetOwnCopy(block.postings).shrink_to_fit();
+                }
+            }
+            return;
+        }
+        // Runs of plain blocks are regrouped into full blocks before compressing them
+        auto blocks = std::make_shared<std::vector<Block>>();
+        std::vector<Posting> plain;
+        const auto flush_plain = [&]() {
+            for (size_t block_begin = 0; block_begin < plain.size(); block_begin += BLOCK_SIZE) {
+                blocks->push_back(CompressBlock(plain.data() + block_begin, std::min(BLOCK_SIZE, plain.size() - block_begin), inv_word_counts));
+            }
+            plain.clear();
+        };
+        for (const Block& block : GetBlocks()) {
+            if (block.IsCompressed()) {
+                flush_plain();
+                blocks->push_back(block);
+            } else {
+                const Posting* postings = GetPlain(block);
+                plain.insert(plain.end(), postings, postings + block.size);
+            }
+        }
+        flush_plain();
+        blocks->shrink_to_fit();
+        blocks_ = std::move(blocks);
+    }
+
+    // Whether any block is compressed
+    bool IsCompressed() const {
+        return std::any_of(GetBlocks().begin(), GetBlocks().end(), [](const Block& block) {
+            return block.IsCompressed();
+        });
+    }
+
+    bool Contains(int document_index) const {
+        const std::vector<Block>& blocks = GetBlocks();
+        const size_t block = FindBlock(document_index);
+        if (block == blocks.size()) {
+            return false;
+        }
+        std::array<Posting, BLOCK_SIZE> buffer;
+        const Posting* postings = blocks[block].IsCompressed() ? buffer.data() : GetPlain(blocks[block]);
+        if (blocks[block].IsCompressed()) {
+            DecodeBlock(blocks[block], buffer.data());
+        }
+        const Posting* position = std::lower_bound(postings, postings + blocks[block].size, document_index, [](const Posting& posting, int index) {
+            return posting.document_index < index;
+        });
+        return position != postings + blocks[block].size && position->document_index == document_index;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    const_iterator begin() const {
+        const_iterator result;
+        result.blocks_ = GetBlocks().data();
+        result.block_count_ = GetBlocks().size();
+        result.LoadBlock(0);
+        return result;
+    }
+
+    Sentinel end() const {
+        return {};
+    }
+
+    double GetMaxTermFreq() const {
+        return max_term_freq_;
+    }
+
+    // Decodes a compressed block into out, returns the number of postings
+    static size_t DecodeBlock(const Block& block, Posting* out) {
+        std::array<uint32_t, BLOCK_SIZE> gaps;
+        std::array<uint32_t, BLOCK_SIZE> counts;
+        const uint8_t* in = DecodeStreamVByte(block.bytes->data(), block.size, gaps.data());
+        DecodeStreamVByte(in, block.size, counts.data());
+        const double* inv_word_counts = block.inv_word_counts->data();
+        int document_index = 0;
+        for (size_t i = 0; i < block.size; ++i) {
+            document_index += gaps[i];
+            out[i] = {document_index, counts[i] * inv_word_counts[document_index]};
+        }
+        return block.size;
+    }
+
+private:
+    // Null while the list has never held a posting
+    std::shared_ptr<std::vector<Block>> blocks_;
+    size_t size_ = 0;
+    double max_term_freq_ = 0.0;
+
+    const std::vector<Block>& GetBlocks() const {
+        static const std::vector<Block> no_blocks;
+        return blocks_ ? *blocks_ : no_blocks;
+    }
+
+    static const Posting* GetPlain(const Block& block) {
+        return block.borrowed ? block.borrowed : block.postings->data();
+    }
+
+    static std::vector<Posting> GetPostings(const Block& block) {
+        if (block.IsCompressed()) {
+            std::vector<Posting> postings(block.size);
+            DecodeBlock(block, postings.data());
+            return postings;
+        }
+        const Posting* postings = GetPlain(block);
+        return {postings, postings + block.size};
+    }
+
+    static Block UpdateBlockBounds(Block block) {
+        const Posting* postings = GetPlain(block);
+        block.last_document_index = postings[block.size - 1].document_index;
+        block.max_term_freq = 0.0;
+        for (size_t i = 0; i < block.size; ++i) {
+            block.max_term_freq = std::max(block.max_term_freq, postings[i].term_freq);
+        }
+        return block;
+    }
+
+    // A compressed block, or a plain one if a frequency is not a count times the inverse word count
+    static Block CompressBlock(const Posting* postings, size_t size, const std::shared_ptr<const std::vector<double>>& inv_word_counts) {
+        std::array<uint32_t, BLOCK_SIZE> gaps;
+        std::array<uint32_t, BLOCK_SIZE> counts;
+        int previous_document_index = 0;
+        for (size_t i = 0; i < size; ++i) {
+            const double inv_word_count = (*inv_word_counts)[postings[i].document_index];
+            counts[i] = std::lround(postings[i].term_freq / inv_word_count);
+            if (counts[i] * inv_word_count != postings[i].term_freq) {
+                Block block;
+                block.postings = std::make_shared<std::vector<Posting>>(postings, postings + size);
+                block.size = size;
+                return UpdateBlockBounds(std::move(block));
+            }
+            gaps[i] = postings[i].document_index - previous_document_index;
+            previous_document_index = postings[i].document_index;
+        }
+        Block block;
+        block.size = size;
+        block.last_document_index = postings[size - 1].document_index;
+        for (size_t i = 0; i < size; ++i) {
+            block.max_term_freq = std::max(block.max_term_freq, postings[i].term_freq);
+        }
+        std::vector<uint8_t> bytes;
+        EncodeStreamVByte(gaps.data(), size, bytes);
+        EncodeStreamVByte(counts.data(), size, bytes);
+        bytes.resize(bytes.size() + STREAM_VBYTE_PADDING);
+        bytes.shrink_to_fit();
+        block.bytes = std::make_shared<const std::vector<uint8_t>>(std::move(bytes));
+        block.inv_word_counts = inv_word_counts;
+        return block;
+    }
+
+    // Puts the changed postings of a block back: a compressed block is compressed again with the inverse
+    // word counts it had, a block that grew too large is split in two, an empty one is dropped
+    void ReplaceBlock(size_t block, std::vector<Posting> postings) {
+        std::vector<Block>& blocks = GetOwnCopy(blocks_);
+        if (postings.empty()) {
+            blocks.erase(blocks.begin() + block);
+            return;
+        }
+        const auto inv_word_counts = blocks[block].inv_word_counts;
+        const auto make_block = [&inv_word_counts](const Posting* begin, const Posting* end) {
+            if (inv_word_counts) {
+                return CompressBlock(begin, end - begin, inv_word_counts);
+            }
+            Block result;
+            result.postings = std::make_shared<std::vector<Posting>>(begin, end);
+            result.size = result.postings->size();
+            return UpdateBlockBounds(std::move(result));
+        };
+        if (postings.size() > (inv_word_counts ? BLOCK_SIZE : PLAIN_BLOCK_SIZE)) {
+            const Posting* middle = postings.data() + postings.size() / 2;
+            blocks[block] = make_block(postings.data(), middle);
+            blocks.insert(blocks.begin() + block + 1, make_block(middle, postings.data() + postings.size()));
+            return;
+        }
+        blocks[block] = make_block(postings.data(), postings.data() + postings.size());
+    }
+
+    // The block that would hold document_index, the block count if it is past the last one
+    size_t FindBlock(int document_index) const {
+        const std::vector<Block>& blocks = GetBlocks();
+        return std::lower_bound(blocks.begin(), blocks.end(), document_index, [](const Block& block, int index) {
+                   return block.last_document_index < index;
+               })
+               - blocks.begin();
+    }
+
+    void UpdateMaxTermFreq() {
+        max_term_freq_ = 0.0;
+        for (const Block& block : GetBlocks()) {
+            max_term_freq_ = std::max(max_term_freq_, block.max_term_freq);
+        }
+    }
+};
@@ -1,19 +1,42 @@
 #include <execution>
+#include <numeric>
 #include "process_queries.h"
 
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries) {
-    std::vector<std::vector<Document>> result(queries.size());
-    std::transform(std::execution::par, queries.begin(), queries.end(), result.begin(), [&search_server] (const std::string & query) {return search_server.FindTopDocuments(query);});
-    return result;
+    return search_server.FindTopDocumentsBatch(queries);
 }
 
-std::list<Document> ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries) {
-    std::vector<std::vector<Document>> documents = ProcessQueries(search_server, queries);
-    std::list<Document> result;
-    for (const std::vector<Document>& document : documents) {
-        result.insert(result.end(), document.begin(), document.end());
+std::vector<SearchResult> ProcessQueriesWithTimeout(const SearchServer& search_server, const std::vector<std::string>& queries,
+                                                    std::chrono::steady_clock::duration query_timeout, const CancellationToken& cancellation) {
+    std::vector<SearchResult> results(queries.size());
+    // Exceptions must not escape a parallel algorithm, they are parked and the first one is rethrown
+    std::vector<std::exception_ptr> errors(queries.size());
+    std::vector<size_t> positions(queries.size());
+    std::iota(positions.begin(), positions.end(), 0);
+    std::for_each(std::execution::par, positions.begin(), positions.end(), [&](size_t position) {
+        try {
+            results[position] = search_server.FindTopDocuments(queries[position], SearchLimits::Within(query_timeout, cancellation));
+        } catch (...) {
+            errors[position] = std::current_exception();
+        }
+    });
+    for (const auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
     }
-    
+    return results;
+}
+
+JoinedDocuments ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries) {
+    JoinedDocuments result;
+    result.documents.reserve(queries.size() * SearchServer::MAX_RESULT_DOCUMENT_COUNT);
+    result.offsets.reserve(queries.size() + 1);
+    result.offsets.push_back(0);
+    ProcessQueriesStreamed(search_server, queries, [&result](size_t, const std::vector<Document>& documents) {
+        result.documents.insert(result.documents.end(), documents.begin(), documents.end());
+        result.offsets.push_back(result.documents.size());
+    });
     return result;
 }
 
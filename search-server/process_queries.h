@@ -1,11 +1,81 @@
 #pragma once
-#include <list>
-#include "search_server.h" 
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <string>
+#include <vector>
+#include "search_server.h"
+#include "search_thread_pool.h"
 
 std::vector<std::vector<Document>> ProcessQueries(
     const SearchServer& search_server,
-    const std::vector<std::string>& queries); 
+    const std::vector<std::string>& queries);
 
-std::list<Document> ProcessQueriesJoined(
+// Results of all queries in one contiguous buffer, the documents of query i are
+// documents[offsets[i]] ... documents[offsets[i + 1] - 1]. Iterates over all documents in query order
+struct JoinedDocuments {
+    std::vector<Document> documents;
+    std::vector<size_t> offsets;
+
+    std::vector<Document>::const_iterator begin() const {
+        return documents.begin();
+    }
+    std::vector<Document>::const_iterator end() const {
+        return documents.end();
+    }
+    size_t size() const {
+        return documents.size();
+    }
+};
+
+// Answers every query like FindTopDocuments(raw_query), in parallel and each on its own time budget:
+// a query still running query_timeout after it started returns what it has so far, flagged partial.
+// Cancelling stops the queries left at once. One slow query cannot hold the batch up for longer than its budget
+std::vector<SearchResult> ProcessQueriesWithTimeout(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    std::chrono::steady_clock::duration query_timeout,
+    const CancellationToken& cancellation = {});
+
+JoinedDocuments ProcessQueriesJoined(
     const SearchServer& search_server,
-    const std::vector<std::string>& queries); 
+    const std::vector<std::string>& queries);
+
+// Queries are answered in windows of this size while the previous window is being consumed
+const size_t PROCESS_QUERIES_WINDOW = 256;
+
+// Calls consumer(query_index, documents) for every query in order. The next window of queries
+// is computed on SearchThreadPool meanwhile, so results can be sent on before the whole batch is done
+template <typename Consumer>
+void ProcessQueriesStreamed(const SearchServer& search_server, const std::vector<std::string>& queries, Consumer consumer) {
+    const auto find_window = [&search_server, &queries](size_t begin) {
+        const size_t end = std::min(begin + PROCESS_QUERIES_WINDOW, queries.size());
+        return search_server.FindTopDocumentsBatch({queries.begin() + begin, queries.begin() + end});
+    };
+    if (queries.empty()) {
+        return;
+    }
+    std::vector<std::vector<Document>> window = find_window(0);
+    for (size_t begin = 0; begin < queries.size(); begin += PROCESS_QUERIES_WINDOW) {
+        std::future<std::vector<std::vector<Document>>> next_window;
+        if (begin + PROCESS_QUERIES_WINDOW < queries.size()) {
+            next_window = SearchThreadPool::Get().Submit([&find_window, next_begin = begin + PROCESS_QUERIES_WINDOW] {
+                return find_window(next_begin);
+            });
+        }
+        try {
+            for (size_t i = 0; i < window.size(); ++i) {
+                consumer(begin + i, window[i]);
+            }
+        } catch (...) {
+            // Unlike a future of std::async, this one does not wait on destruction, and the window refers to the queries
+            if (next_window.valid()) {
+                next_window.wait();
+            }
+            throw;
+        }
+        if (next_window.valid()) {
+            window = next_window.get();
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// The current version of an immutable value, replaced by read-copy-update.
+// Readers pin a version with an atomic load and keep it as long as they need, Publish swaps in
+// the next one. Replaced versions are freed by a later Publish once no reader holds them any more,
+// so a reader never pays for destroying one. Calls of Publish must be serialized by the owner
+template <typename T>
+class Published {
+public:
+    explicit Published(std::shared_ptr<const T> value)
+        : current_(std::move(value)) {
+    }
+
+    std::shared_ptr<const T> Pin() const {
+        return std::atomic_load_explicit(&current_, std::memory_order_acquire);
+    }
+
+    // For the publisher only: nobody else replaces the value, so it is read without synchronization
+    const T& Get() const {
+        return *current_;
+    }
+
+    void Publish(std::shared_ptr<const T> next) {
+        retired_.push_back(std::atomic_exchange_explicit(&current_, std::move(next), std::memory_order_acq_rel));
+        // A retired version can not be pinned any more, once retired_ holds its last reference no reader is left
+        retired_.erase(std::remove_if(retired_.begin(), retired_.end(),
+                                      [](const std::shared_ptr<const T>& version) {
+                                          return version.use_count() == 1;
+                                      }),
+                       retired_.end());
+    }
+
+private:
+    std::shared_ptr<const T> current_;
+    std::vector<std::shared_ptr<const T>> retired_;
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+#include <utility>
+
+// Monotonic memory for the short-lived vectors of searches on one thread. Allocation is a pointer bump
+// and nothing is freed one by one: the memory is reclaimed all at once when the last lease ends.
+// Searches nested on the same thread (a TBB worker waiting in a parallel search may pick up another one)
+// hold their own leases and just extend the arena. A lease has to end on the thread that took it
+class QueryArena {
+public:
+    class Lease {
+    public:
+        // Without an arena: allocates from the heap, for data that leaves the thread
+        Lease() = default;
+
+        explicit Lease(QueryArena& arena)
+            : arena_(&arena) {
+            ++arena_->lease_count_;
+        }
+
+        Lease(Lease&& other) noexcept
+            : arena_(std::exchange(other.arena_, nullptr)) {
+        }
+
+        Lease& operator=(Lease&& other) noexcept {
+            if (this != &other) {
+                Release();
+                arena_ = std::exchange(other.arena_, nullptr);
+            }
+            return *this;
+        }
+
+        ~Lease() {
+            Release();
+        }
+
+        std::pmr::memory_resource* GetResource() const {
+            return arena_ != nullptr ? &arena_->resource_ : std::pmr::new_delete_resource();
+        }
+
+    private:
+        QueryArena* arena_ = nullptr;
+
+        void Release() {
+            if (arena_ != nullptr && --arena_->lease_count_ == 0) {
+                arena_->resource_.release();
+            }
+        }
+    };
+
+    QueryArena() = default;
+    QueryArena(const QueryArena&) = delete;
+    QueryArena& operator=(const QueryArena&) = delete;
+
+private:
+    // Enough for the queries of usual length without touching the heap at all
+    static constexpr size_t INITIAL_SIZE = 16 * 1024;
+
+    alignas(std::max_align_t) std::byte initial_buffer_[INITIAL_SIZE];
+    std::pmr::monotonic_buffer_resource resource_{initial_buffer_, INITIAL_SIZE, std::pmr::new_delete_resource()};
+    size_t lease_count_ = 0;
+};
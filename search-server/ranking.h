@@ -0,0 +1,101 @@
+#pragma once
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// Figures of the whole index a ranking may depend on, taken once per search
+struct CorpusStatistics {
+    int document_count = 0;
+    // Words of a document without stop words, on average
+    double average_word_count = 0.0;
+};
+
+// A ranking policy turns postings into relevances. Prepare(corpus) returns the scorer of one search:
+//   WeighTerm(inv_document_freq) is the constant of a plus term, computed once per query;
+//   scorer(term_weight, term_freq, word_count) is what a posting adds to the relevance of its document,
+//     term_freq being the share of the term among the word_count words of the document;
+//   MaxScore(term_weight, max_term_freq) bounds that for term frequencies up to max_term_freq.
+//     Score pruning relies on it, so a score must not fall as term_freq grows.
+// The scorer is a template argument of the search, so it is inlined into the posting loop
+
+// Term frequency times inverse document frequency, what searches use unless told otherwise
+struct TfIdfRanking {
+    struct Scorer {
+        double WeighTerm(double inv_document_freq) const {
+            return inv_document_freq;
+        }
+
+        double operator()(double term_weight, double term_freq, int /*word_count*/) const {
+            return term_freq * term_weight;
+        }
+
+        double MaxScore(double term_weight, double max_term_freq) const {
+            return term_weight * max_term_freq;
+        }
+    };
+
+    Scorer Prepare(const CorpusStatistics& /*corpus*/) const {
+        return {};
+    }
+};
+
+// Okapi BM25 over the inverse document frequencies of the index: the count of a term in a document
+// saturates at k1, and b says how much a document longer than the average is penalized for its length
+class Bm25Ranking {
+public:
+    explicit Bm25Ranking(double k1 = 1.2, double b = 0.75)
+        : k1_(k1)
+        , b_(b) {
+        using namespace std::string_literals;
+        if (!(k1 >= 0.0) || !(b >= 0.0 && b <= 1.0)) {
+            throw std::invalid_argument("BM25 needs k1 >= 0 and 0 <= b <= 1"s);
+        }
+    }
+
+    // count / (count + k1 * (1 - b + b * word_count / average_word_count)) with count = term_freq * word_count,
+    // the constant parts folded per search and per term
+    class Scorer {
+    public:
+        Scorer(double k1, double b, double average_word_count)
+            : k1_(k1)
+            , length_free_norm_(k1 * (1.0 - b))
+            , length_norm_(average_word_count > 0.0 ? k1 * b / average_word_count : 0.0) {
+        }
+
+        double WeighTerm(double inv_document_freq) const {
+            return inv_document_freq * (k1_ + 1.0);
+        }
+
+        double operator()(double term_weight, double term_freq, int word_count) const {
+            const double count = term_freq * word_count;
+            return term_weight * count / (count + length_free_norm_ + length_norm_ * word_count);
+        }
+
+        // The score is term_weight * term_freq / (term_freq + length_free_norm / word_count + length_norm),
+        // largest for a document of unbounded length
+        double MaxScore(double term_weight, double max_term_freq) const {
+            return term_weight * max_term_freq / (max_term_freq + length_norm_);
+        }
+
+    private:
+        double k1_;
+        double length_free_norm_;
+        double length_norm_;
+    };
+
+    Scorer Prepare(const CorpusStatistics& corpus) const {
+        return Scorer(k1_, b_, corpus.average_word_count);
+    }
+
+private:
+    double k1_;
+    double b_;
+};
+
+template <typename Ranking, typename = void>
+struct IsRankingPolicy : std::false_type {};
+
+template <typename Ranking>
+struct IsRankingPolicy<Ranking, std::void_t<decltype(std::declval<const Ranking&>().Prepare(std::declval<const CorpusStatistics&>()))>>
+    : std::true_type {};
@@ -1,26 +1,194 @@
 #include "remove_duplicates.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <execution>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
 
 using namespace std::string_literals;
- 
-void RemoveDuplicates(SearchServer& search_server) {
-    std::set<int> id_del;
-    std::set<std::set<std::string>> unique_words_;
-    for (const int doc_id : search_server) {
-        std::map<std::string, double> all_words;
-        
-        all_words = search_server.GetWordFrequencies(doc_id);
-        std::set<std::string> unique_words;
-        
-        std::transform(all_words.begin(),all_words.end(), inserter(unique_words, unique_words.begin()), [] (auto m) {return m.first;});
-        
-        if (unique_words_.count(unique_words)) {
-            id_del.insert(doc_id);
+
+namespace {
+
+uint64_t MixHash(uint64_t value) {
+    value += 0x9E3779B97F4A7C15ull;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
+
+// Sum and xor of two independent word hashes do not depend on the order of the words
+struct WordSetSignature {
+    uint64_t sum = 0;
+    uint64_t xor_ = 0;
+
+    bool operator<(const WordSetSignature& other) const {
+        return std::tie(sum, xor_) < std::tie(other.sum, other.xor_);
+    }
+    bool operator==(const WordSetSignature& other) const {
+        return sum == other.sum && xor_ == other.xor_;
+    }
+};
+
+WordSetSignature ComputeSignature(const std::vector<TermId>& terms) {
+    WordSetSignature signature;
+    for (const TermId term : terms) {
+        signature.sum += MixHash(term);
+        signature.xor_ ^= MixHash(term ^ 0xD6E8FEB86659FD93ull);
+    }
+    signature.sum += MixHash(terms.size());
+    return signature;
+}
+
+void ReportAndRemove(SearchServer& search_server, std::vector<int>& duplicate_ids) {
+    std::sort(duplicate_ids.begin(), duplicate_ids.end());
+    for (const int id : duplicate_ids) {
+        std::cout << "Found duplicate document id "s << id << std::endl;
+    }
+    search_server.RemoveDocuments(std::execution::par, duplicate_ids);
+}
+
+const size_t MIN_HASH_COUNT = 128;
+
+using MinHashSignature = std::array<uint64_t, MIN_HASH_COUNT>;
+
+MinHashSignature ComputeMinHash(const std::vector<TermId>& terms) {
+    MinHashSignature signature;
+    signature.fill(UINT64_MAX);
+    for (const TermId term : terms) {
+        const uint64_t base = MixHash(term);
+        for (size_t i = 0; i < MIN_HASH_COUNT; ++i) {
+            signature[i] = std::min(signature[i], MixHash(base + i * 0x9E3779B97F4A7C15ull));
+        }
+    }
+    return signature;
+}
+
+// The band count b and rows per band r give a pair of similarity s the chance 1 - (1 - s^r)^b
+// to share a band. The S-curve's midpoint (1/b)^(1/r) is kept below the threshold,
+// so pairs at the threshold are found with high probability
+size_t ChooseRowsPerBand(double similarity_threshold) {
+    size_t rows = 1;
+    for (size_t candidate = 2; candidate <= MIN_HASH_COUNT; candidate *= 2) {
+        const double bands = MIN_HASH_COUNT / candidate;
+        if (std::pow(1.0 / bands, 1.0 / candidate) > similarity_threshold * 0.85) {
+            break;
+        }
+        rows = candidate;
+    }
+    return rows;
+}
+
+double ComputeJaccardSimilarity(const std::vector<TermId>& lhs, const std::vector<TermId>& rhs) {
+    if (lhs.empty() && rhs.empty()) {
+        return 1.0;
+    }
+    size_t common = 0;
+    auto left = lhs.begin();
+    auto right = rhs.begin();
+    while (left != lhs.end() && right != rhs.end()) {
+        if (*left < *right) {
+            ++left;
+        } else if (*right < *left) {
+            ++right;
         } else {
-            unique_words_.insert(unique_words);
+            ++common;
+            ++left;
+            ++right;
+        }
+    }
+    return common * 1.0 / (lhs.size() + rhs.size() - common);
+}
+
+}  // namespace
+
+void RemoveDuplicates(SearchServer& search_server) {
+    const std::vector<int> ids(search_server.begin(), search_server.end());
+    std::vector<WordSetSignature> signatures(ids.size());
+    std::transform(std::execution::par, ids.begin(), ids.end(), signatures.begin(), [&search_server](int id) {
+        return ComputeSignature(search_server.GetDocumentTerms(id));
+    });
+
+    // Positions grouped by signature, ascending ids inside a group
+    std::vector<size_t> positions(ids.size());
+    std::iota(positions.begin(), positions.end(), 0);
+    std::sort(std::execution::par, positions.begin(), positions.end(), [&](size_t lhs, size_t rhs) {
+        return std::tie(signatures[lhs], lhs) < std::tie(signatures[rhs], rhs);
+    });
+
+    std::vector<int> duplicate_ids;
+    for (size_t group_begin = 0; group_begin < positions.size();) {
+        size_t group_end = group_begin + 1;
+        while (group_end < positions.size() && signatures[positions[group_end]] == signatures[positions[group_begin]]) {
+            ++group_end;
+        }
+        if (group_end - group_begin > 1) {
+            // Almost always one word set, a hash collision merely adds another kept representative
+            std::vector<std::vector<TermId>> kept;
+            for (size_t i = group_begin; i < group_end; ++i) {
+                auto terms = search_server.GetDocumentTerms(ids[positions[i]]);
+                if (std::find(kept.begin(), kept.end(), terms) != kept.end()) {
+                    duplicate_ids.push_back(ids[positions[i]]);
+                } else {
+                    kept.push_back(std::move(terms));
+                }
+            }
         }
+        group_begin = group_end;
+    }
+    ReportAndRemove(search_server, duplicate_ids);
+}
+
+void RemoveNearDuplicates(SearchServer& search_server, double similarity_threshold) {
+    if (similarity_threshold <= 0.0 || similarity_threshold > 1.0) {
+        throw std::invalid_argument("Similarity threshold must be in (0, 1]"s);
     }
-    for (auto id: id_del) {
-        std::cout<<"Found duplicate document id "<< id <<std::endl;
-        search_server.RemoveDocument(id);
+    const std::vector<int> ids(search_server.begin(), search_server.end());
+    std::vector<std::vector<TermId>> terms(ids.size());
+    std::transform(std::execution::par, ids.begin(), ids.end(), terms.begin(), [&search_server](int id) {
+        return search_server.GetDocumentTerms(id);
+    });
+    std::vector<MinHashSignature> signatures(ids.size());
+    std::transform(std::execution::par, terms.begin(), terms.end(), signatures.begin(), ComputeMinHash);
+
+    const size_t rows = ChooseRowsPerBand(similarity_threshold);
+    const size_t band_count = MIN_HASH_COUNT / rows;
+    const auto band_key = [&](size_t position, size_t band) {
+        uint64_t key = MixHash(band);
+        for (size_t row = band * rows; row < (band + 1) * rows; ++row) {
+            key = MixHash(key ^ signatures[position][row]);
+        }
+        return key;
+    };
+
+    // Documents are visited by ascending id and compared only with documents kept so far,
+    // so of every similar group the one with the smallest id survives
+    std::vector<std::unordered_map<uint64_t, std::vector<size_t>>> bands(band_count);
+    std::vector<int> duplicate_ids;
+    std::vector<size_t> candidates;
+    for (size_t position = 0; position < ids.size(); ++position) {
+        candidates.clear();
+        for (size_t band = 0; band < band_count; ++band) {
+            const auto bucket = bands[band].find(band_key(position, band));
+            if (bucket != bands[band].end()) {
+                candidates.insert(candidates.end(), bucket->second.begin(), bucket->second.end());
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        const bool is_duplicate = std::any_of(candidates.begin(), candidates.end(), [&](size_t kept) {
+            return ComputeJaccardSimilarity(terms[kept], terms[position]) >= similarity_threshold;
+        });
+        if (is_duplicate) {
+            duplicate_ids.push_back(ids[position]);
+            continue;
+        }
+        for (size_t band = 0; band < band_count; ++band) {
+            bands[band][band_key(position, band)].push_back(position);
+        }
     }
+    ReportAndRemove(search_server, duplicate_ids);
 }
@@ -1,4 +1,11 @@
 #pragma once
 #include "search_server.h"
 
+// Removes every document whose set of words equals the set of a document with a smaller id.
+// Word sets are compared by a 128-bit signature computed in parallel and verified exactly on a match
 void RemoveDuplicates(SearchServer& search_server);
+
+// Removes every document whose word set has Jaccard similarity of at least similarity_threshold
+// with a kept document of smaller id. Candidates come from MinHash signatures split into LSH bands,
+// each candidate pair is verified exactly, so only similar pairs that share no band can be missed
+void RemoveNearDuplicates(SearchServer& search_server, double similarity_threshold);
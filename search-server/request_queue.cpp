@@ -1,4 +1,5 @@
 #include "request_queue.h"
+#include <algorithm>
 
 
 std::vector<Document> RequestQueue::AddFindRequest(std::string_view raw_query, DocumentStatus status) {
@@ -13,5 +14,5 @@ std::vector<Document> RequestQueue::AddFindRequest(std::string_view raw_query) {
 }
 int RequestQueue:: GetNoResultRequests() const {
         // напишите реализацию
-    return count_if(requests_.begin(),requests_.end(), [](QueryResult query){return query.query_==0;});
+    return std::count_if(requests_.begin(),requests_.end(), [](QueryResult query){return query.query_==0;});
 }
@@ -1,4 +1,10 @@
+#pragma once
 #include <deque>
+#include <string_view>
+#include <vector>
+#include "document.h"
+#include "search_server.h"
+
 class RequestQueue {
 public:
     explicit RequestQueue(const SearchServer& search_server) :server(search_server){}
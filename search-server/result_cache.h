@@ -0,0 +1,229 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "document.h"
+#include "term_dictionary.h"
+
+// Names the predicate of a search whose results may be cached. Searches with equal keys
+// and equal queries must accept the same documents
+struct ResultCacheKey {
+    uint64_t value;
+};
+
+struct ResultCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+// Results of recent searches, split into shards with a lock each.
+// A full shard evicts its least recently used entry, but only for a search asked for more often
+// than that entry (TinyLFU admission), so a stream of one-off queries can not push popular ones out.
+// Invalidate makes all entries stale at once, they are dropped when met.
+// A copy starts empty with the same capacity
+class QueryResultCache {
+public:
+    // A parsed query as ParseQuery normalizes it, the filter and the result count
+    struct Key {
+        std::vector<TermId> plus_terms;
+        std::vector<TermId> minus_terms;
+        // The statuses of the DocumentFilter searched with, or the ResultCacheKey of the predicate
+        bool by_filter;
+        uint64_t filter;
+        // Rating range of the DocumentFilter
+        int min_rating;
+        int max_rating;
+        size_t max_result_count;
+
+        bool operator==(const Key& other) const {
+            return plus_terms == other.plus_terms && minus_terms == other.minus_terms && by_filter == other.by_filter
+                && filter == other.filter && min_rating == other.min_rating && max_rating == other.max_rating
+                && max_result_count == other.max_result_count;
+        }
+    };
+
+    static constexpr size_t MAX_SHARD_COUNT = 16;
+
+    explicit QueryResultCache(size_t capacity = 0) {
+        Reset(capacity);
+    }
+
+    QueryResultCache(const QueryResultCache& other)
+        : QueryResultCache(other.capacity_) {
+    }
+
+    // Drops all entries and statistics, 0 turns the cache off
+    void Reset(size_t capacity) {
+        capacity_ = capacity;
+        shards_.clear();
+        const size_t shard_count = std::min(capacity, MAX_SHARD_COUNT);
+        for (size_t shard = 0; shard < shard_count; ++shard) {
+            shards_.push_back(std::make_unique<Shard>((capacity + shard_count - 1) / shard_count));
+        }
+        hits_ = 0;
+        misses_ = 0;
+    }
+
+    bool IsEnabled() const {
+        return capacity_ > 0;
+    }
+
+    std::optional<std::vector<Document>> Find(const Key& key) {
+        const uint64_t hash = KeyHasher()(key);
+        Shard& shard = GetShard(hash);
+        std::lock_guard guard(shard.mutex);
+        shard.sketch.Increment(hash);
+        const auto found = shard.entries.find(key);
+        if (found != shard.entries.end()) {
+            if (found->second->generation == generation_) {
+                shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return found->second->documents;
+            }
+            shard.lru.erase(found->second);
+            shard.entries.erase(found);
+        }
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+
+    void Insert(Key key, const std::vector<Document>& documents) {
+        const uint64_t hash = KeyHasher()(key);
+        Shard& shard = GetShard(hash);
+        std::lock_guard guard(shard.mutex);
+        const auto found = shard.entries.find(key);
+        if (found != shard.entries.end()) {
+            found->second->documents = documents;
+            found->second->generation = generation_;
+            shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+            return;
+        }
+        if (shard.lru.size() >= shard.capacity) {
+            const Entry& victim = shard.lru.back();
+            if (victim.generation == generation_ && shard.sketch.Estimate(hash) <= shard.sketch.Estimate(KeyHasher()(victim.key))) {
+                return;
+            }
+            shard.entries.erase(victim.key);
+            shard.lru.pop_back();
+        }
+        shard.lru.push_front({std::move(key), documents, generation_});
+        shard.entries.emplace(shard.lru.front().key, shard.lru.begin());
+    }
+
+    // Called on every change of the index, which no search may run concurrently with
+    void Invalidate() {
+        ++generation_;
+    }
+
+    ResultCacheStats GetStats() const {
+        return {hits_.load(std::memory_order_relaxed), misses_.load(std::memory_order_relaxed)};
+    }
+
+private:
+    struct KeyHasher {
+        uint64_t operator()(const Key& key) const {
+            uint64_t hash = key.by_filter ? 0x9E3779B97F4A7C15ull : 0;
+            const auto mix = [&hash](uint64_t value) {
+                hash = (hash ^ value) * 0x100000001B3ull;
+                hash ^= hash >> 29;
+            };
+            mix(key.filter);
+            mix(static_cast<uint32_t>(key.min_rating) | static_cast<uint64_t>(static_cast<uint32_t>(key.max_rating)) << 32);
+            mix(key.max_result_count);
+            for (const TermId term : key.plus_terms) {
+                mix(term);
+            }
+            mix(key.plus_terms.size());
+            for (const TermId term : key.minus_terms) {
+                mix(term);
+            }
+            return hash * 0xBF58476D1CE4E5B9ull ^ (hash >> 31);
+        }
+    };
+
+    // Approximate request counts: a count-min sketch of small saturating counters.
+    // All counters are halved every SAMPLE_FACTOR * capacity requests, so old popularity fades
+    class FrequencySketch {
+    public:
+        static constexpr size_t ROW_COUNT = 4;
+        static constexpr uint8_t MAX_COUNT = 15;
+        static constexpr size_t SAMPLE_FACTOR = 10;
+
+        explicit FrequencySketch(size_t capacity)
+            : sample_size_(SAMPLE_FACTOR * capacity) {
+            size_t width = 16;
+            while (width < 4 * capacity) {
+                width *= 2;
+            }
+            counters_.assign(width, 0);
+        }
+
+        void Increment(uint64_t hash) {
+            for (size_t row = 0; row < ROW_COUNT; ++row) {
+                uint8_t& counter = counters_[GetIndex(hash, row)];
+                counter += counter < MAX_COUNT;
+            }
+            if (++request_count_ >= sample_size_) {
+                for (uint8_t& counter : counters_) {
+                    counter /= 2;
+                }
+                request_count_ /= 2;
+            }
+        }
+
+        int Estimate(uint64_t hash) const {
+            int estimate = MAX_COUNT;
+            for (size_t row = 0; row < ROW_COUNT; ++row) {
+                estimate = std::min<int>(estimate, counters_[GetIndex(hash, row)]);
+            }
+            return estimate;
+        }
+
+    private:
+        std::vector<uint8_t> counters_;
+        size_t sample_size_;
+        size_t request_count_ = 0;
+
+        size_t GetIndex(uint64_t hash, size_t row) const {
+            const uint64_t row_hash = (hash + row * 0x9E3779B97F4A7C15ull) * 0xFF51AFD7ED558CCDull;
+            return (row_hash >> 32) & (counters_.size() - 1);
+        }
+    };
+
+    struct Entry {
+        Key key;
+        std::vector<Document> documents;
+        uint64_t generation;
+    };
+
+    // Every shard sits on its own cache lines so that neighbouring locks do not false-share
+    struct alignas(64) Shard {
+        explicit Shard(size_t capacity)
+            : capacity(capacity)
+            , sketch(capacity) {
+        }
+
+        std::mutex mutex;
+        size_t capacity;
+        // Most recently used first
+        std::list<Entry> lru;
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHasher> entries;
+        FrequencySketch sketch;
+    };
+
+    size_t capacity_ = 0;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    uint64_t generation_ = 0;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+
+    Shard& GetShard(uint64_t hash) {
+        return *shards_[(hash >> 7) % shards_.size()];
+    }
+};
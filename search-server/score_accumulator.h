@@ -0,0 +1,119 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Dense relevance scratch indexed by internal document index and reused between queries.
+// Slots are valid only while their stamp equals the current generation, so starting
+// a new query costs O(1) instead of clearing the whole array.
+class ScoreAccumulator {
+public:
+    void Reset(size_t document_count) {
+        if (scores_.size() < document_count) {
+            scores_.resize(document_count);
+            score_stamps_.resize(document_count);
+            exclusion_stamps_.resize(document_count);
+        }
+        touched_.clear();
+        if (++generation_ == 0) {
+            std::fill(score_stamps_.begin(), score_stamps_.end(), 0);
+            std::fill(exclusion_stamps_.begin(), exclusion_stamps_.end(), 0);
+            generation_ = 1;
+        }
+    }
+
+    void Exclude(int document_index) {
+        exclusion_stamps_[document_index] = generation_;
+    }
+
+    bool IsExcluded(int document_index) const {
+        return exclusion_stamps_[document_index] == generation_;
+    }
+
+    void Add(int document_index, double relevance) {
+        if (score_stamps_[document_index] != generation_) {
+            score_stamps_[document_index] = generation_;
+            scores_[document_index] = relevance;
+            touched_.push_back(document_index);
+        } else {
+            scores_[document_index] += relevance;
+        }
+    }
+
+    // Documents that got at least one Add since the last Reset, in order of first touch
+    const std::vector<int>& GetTouched() const {
+        return touched_;
+    }
+
+    double GetScore(int document_index) const {
+        return scores_[document_index];
+    }
+
+private:
+    uint32_t generation_ = 0;
+    std::vector<double> scores_;
+    std::vector<uint32_t> score_stamps_;
+    std::vector<uint32_t> exclusion_stamps_;
+    std::vector<int> touched_;
+};
+
+// Scores of a group of queries answered together over a block of documents.
+// Every query owns a contiguous row of slots, so walking a posting list for one query
+// touches its row in increasing order
+class BatchScoreAccumulator {
+public:
+    void Reset(size_t document_count, size_t query_count) {
+        document_count_ = document_count;
+        if (scores_.size() < document_count * query_count) {
+            scores_.resize(document_count * query_count);
+            score_stamps_.resize(document_count * query_count);
+            exclusion_stamps_.resize(document_count * query_count);
+        }
+        if (touched_.size() < query_count) {
+            touched_.resize(query_count);
+        }
+        for (size_t query = 0; query < query_count; ++query) {
+            touched_[query].clear();
+        }
+        if (++generation_ == 0) {
+            std::fill(score_stamps_.begin(), score_stamps_.end(), 0);
+            std::fill(exclusion_stamps_.begin(), exclusion_stamps_.end(), 0);
+            generation_ = 1;
+        }
+    }
+
+    void Exclude(int document_index, size_t query) {
+        exclusion_stamps_[query * document_count_ + document_index] = generation_;
+    }
+
+    // Adds unless the document is excluded for the query
+    void Add(int document_index, size_t query, double relevance) {
+        const size_t slot = query * document_count_ + document_index;
+        if (exclusion_stamps_[slot] == generation_) {
+            return;
+        }
+        if (score_stamps_[slot] != generation_) {
+            score_stamps_[slot] = generation_;
+            scores_[slot] = relevance;
+            touched_[query].push_back(document_index);
+        } else {
+            scores_[slot] += relevance;
+        }
+    }
+
+    const std::vector<int>& GetTouched(size_t query) const {
+        return touched_[query];
+    }
+
+    double GetScore(int document_index, size_t query) const {
+        return scores_[query * document_count_ + document_index];
+    }
+
+private:
+    uint32_t generation_ = 0;
+    size_t document_count_ = 0;
+    std::vector<double> scores_;
+    std::vector<uint32_t> score_stamps_;
+    std::vector<uint32_t> exclusion_stamps_;
+    std::vector<std::vector<int>> touched_;
+};
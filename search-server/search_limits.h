@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+// Read side of a CancellationSource, cheap to copy. A default token is never cancelled
+class CancellationToken {
+public:
+    CancellationToken() = default;
+
+    bool IsCancelled() const {
+        return state_ != nullptr && state_->load(std::memory_order_relaxed);
+    }
+
+private:
+    friend class CancellationSource;
+
+    explicit CancellationToken(std::shared_ptr<const std::atomic<bool>> state)
+        : state_(std::move(state)) {
+    }
+
+    std::shared_ptr<const std::atomic<bool>> state_;
+};
+
+// Cancels every search holding one of its tokens, from any thread
+class CancellationSource {
+public:
+    CancellationSource()
+        : state_(std::make_shared<std::atomic<bool>>(false)) {
+    }
+
+    void Cancel() {
+        state_->store(true, std::memory_order_relaxed);
+    }
+
+    CancellationToken GetToken() const {
+        return CancellationToken(state_);
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> state_;
+};
+
+// When a search has to give up: at the deadline or once cancelled, whichever comes first
+struct SearchLimits {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    CancellationToken cancellation;
+
+    static SearchLimits Within(std::chrono::steady_clock::duration timeout, CancellationToken cancellation = {}) {
+        return {std::chrono::steady_clock::now() + timeout, std::move(cancellation)};
+    }
+
+    bool IsExceeded() const {
+        return cancellation.IsCancelled() || std::chrono::steady_clock::now() >= deadline;
+    }
+};
@@ -1,36 +1,367 @@
 #include "search_server.h"
+#include <cstring>
 #include <numeric>
 
 void SearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings) {
-    if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+    SEARCH_METRICS_TIME(ADD_DOCUMENT);
+    if ((document_id < 0) || document_to_index_.Contains(document_id)) {
         throw std::invalid_argument("Invalid id"s);
     }
-    auto [id_, data_] = documents_.emplace(document_id, DocumentData{std::string(document), ComputeAverageRating(ratings), status});
-    document_ids_.push_back(document_id);
-    const auto words = SplitIntoWordsNoStop(id_->second.data);
-    const double inv_word_count = 1.0 / words.size();
-    for (auto word : words) {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        ids_word_to_document_freqs_[document_id][word] += inv_word_count;
+    int word_count = 0;
+    const auto word_frequencies = ComputeWordFrequencies(document, word_count);
+    const int document_index = documents_.Add(document_id, ComputeAverageRating(ratings), status, word_count);
+    total_word_count_ += word_count;
+    document_to_index_.Insert(document_id, document_index);
+    std::vector<TermFrequency> terms;
+    terms.reserve(word_frequencies.size());
+    for (const auto& [word, term_freq] : word_frequencies) {
+        const TermId term = InternWord(word);
+        terms.push_back({term, term_freq});
+        term_postings_[term].Add(document_index, term_freq);
     }
+    std::sort(terms.begin(), terms.end(), [](const TermFrequency& lhs, const TermFrequency& rhs) {
+        return lhs.term < rhs.term;
+    });
+    document_terms_.Add(terms);
+    OnDocumentsChanged();
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(std::execution::seq, raw_query, status);
+void SearchServer::AddDocuments(const std::vector<RawDocument>& documents) {
+    AddDocumentsImpl(std::execution::seq, documents);
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(std::execution::seq, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
-    });
+void SearchServer::AddDocuments(const std::execution::sequenced_policy&, const std::vector<RawDocument>& documents) {
+    AddDocumentsImpl(std::execution::seq, documents);
+}
+
+void SearchServer::AddDocuments(const std::execution::parallel_policy&, const std::vector<RawDocument>& documents) {
+    AddDocumentsImpl(std::execution::par, documents);
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(std::execution::par, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
+template <typename ExecutionPolicy>
+void SearchServer::AddDocumentsImpl(const ExecutionPolicy& policy, const std::vector<RawDocument>& documents) {
+    std::set<int> batch_ids;
+    for (const RawDocument& document : documents) {
+        if ((document.id < 0) || document_to_index_.Contains(document.id) || !batch_ids.insert(document.id).second) {
+            throw std::invalid_argument("Invalid id"s);
+        }
+    }
+
+    // Tokenizing is independent per document. Exceptions must not escape a parallel algorithm,
+    // so they are parked and the first one in input order is rethrown
+    std::vector<std::vector<std::pair<std::string_view, double>>> word_frequencies(documents.size());
+    std::vector<int> word_counts(documents.size());
+    std::vector<std::exception_ptr> errors(documents.size());
+    std::vector<size_t> positions(documents.size());
+    std::iota(positions.begin(), positions.end(), 0);
+    std::for_each(policy, positions.begin(), positions.end(), [&](size_t position) {
+        try {
+            word_frequencies[position] = ComputeWordFrequencies(documents[position].text, word_counts[position]);
+        } catch (...) {
+            errors[position] = std::current_exception();
+        }
     });
+    for (const auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Every distinct word of the batch is interned once, then documents resolve their words by binary search
+    std::vector<std::string_view> batch_words;
+    for (const auto& frequencies : word_frequencies) {
+        for (const auto& [word, _] : frequencies) {
+            batch_words.push_back(word);
+        }
+    }
+    std::sort(policy, batch_words.begin(), batch_words.end());
+    batch_words.erase(std::unique(batch_words.begin(), batch_words.end()), batch_words.end());
+    std::vector<TermId> batch_terms;
+    batch_terms.reserve(batch_words.size());
+    for (const auto word : batch_words) {
+        batch_terms.push_back(InternWord(word));
+    }
+    std::vector<std::vector<TermFrequency>> terms(documents.size());
+    std::for_each(policy, positions.begin(), positions.end(), [&](size_t position) {
+        auto& document_terms = terms[position];
+        document_terms.reserve(word_frequencies[position].size());
+        for (const auto& [word, term_freq] : word_frequencies[position]) {
+            const auto found = std::lower_bound(batch_words.begin(), batch_words.end(), word);
+            document_terms.push_back({batch_terms[found - batch_words.begin()], term_freq});
+        }
+        std::sort(document_terms.begin(), document_terms.end(), [](const TermFrequency& lhs, const TermFrequency& rhs) {
+            return lhs.term < rhs.term;
+        });
+    });
+
+    const int first_index = documents_.size();
+    for (size_t position = 0; position < documents.size(); ++position) {
+        const RawDocument& document = documents[position];
+        documents_.Add(document.id, ComputeAverageRating(document.ratings), document.status, word_counts[position]);
+        total_word_count_ += word_counts[position];
+        document_to_index_.Insert(document.id, first_index + position);
+    }
+
+    // Sort-based inversion: (term, document) pairs ordered by term and then by document index
+    // give each posting list its new entries as one contiguous run
+    struct BatchPosting {
+        TermId term;
+        Posting posting;
+    };
+    std::vector<BatchPosting> batch_postings;
+    for (size_t position = 0; position < documents.size(); ++position) {
+        for (const auto& [term, term_freq] : terms[position]) {
+            batch_postings.push_back({term, {first_index + static_cast<int>(position), term_freq}});
+        }
+    }
+    std::sort(policy, batch_postings.begin(), batch_postings.end(), [](const BatchPosting& lhs, const BatchPosting& rhs) {
+        return std::tie(lhs.term, lhs.posting.document_index) < std::tie(rhs.term, rhs.posting.document_index);
+    });
+    std::vector<std::pair<size_t, size_t>> runs;
+    for (size_t begin = 0; begin < batch_postings.size();) {
+        size_t end = begin + 1;
+        while (end < batch_postings.size() && batch_postings[end].term == batch_postings[begin].term) {
+            ++end;
+        }
+        runs.push_back({begin, end});
+        begin = end;
+    }
+    std::for_each(policy, runs.begin(), runs.end(), [this, &batch_postings](const auto& run) {
+        auto& postings = term_postings_[batch_postings[run.first].term];
+        for (size_t i = run.first; i < run.second; ++i) {
+            postings.Add(batch_postings[i].posting.document_index, batch_postings[i].posting.term_freq);
+        }
+    });
+    for (const auto& document_terms : terms) {
+        document_terms_.Add(document_terms);
+    }
+    OnDocumentsChanged();
+}
+
+void SearchServer::AddDocumentsFrom(const SearchServer& other, const std::set<int>& skipped_ids) {
+    for (const auto& [document_id, _] : other.document_to_index_) {
+        if (document_to_index_.Contains(document_id) && skipped_ids.count(document_id) == 0) {
+            throw std::invalid_argument("Invalid id"s);
+        }
+    }
+    // Ids of other's terms here, interned on first use
+    std::vector<std::optional<TermId>> terms(other.dictionary_.GetIdBound());
+    for (const auto& [document_id, other_index] : other.document_to_index_) {
+        if (skipped_ids.count(document_id) > 0) {
+            continue;
+        }
+        const int document_index = documents_.Add(document_id, other.documents_.GetRating(other_index), other.documents_.GetStatus(other_index),
+                                                  other.documents_.GetWordCount(other_index));
+        total_word_count_ += other.documents_.GetWordCount(other_index);
+        document_to_index_.Insert(document_id, document_index);
+            const auto other_terms = other.document_terms_.Get(other_index);
+        std::vector<TermFrequency> document_terms;
+        document_terms.reserve(other_terms.size());
+        for (const auto [other_term, term_freq] : other_terms) {
+            if (!terms[other_term]) {
+                terms[other_term] = InternWord(other.dictionary_.GetText(other_term));
+            }
+            document_terms.push_back({*terms[other_term], term_freq});
+            term_postings_[*terms[other_term]].Add(document_index, term_freq);
+        }
+        std::sort(document_terms.begin(), document_terms.end(), [](const TermFrequency& lhs, const TermFrequency& rhs) {
+            return lhs.term < rhs.term;
+        });
+        document_terms_.Add(document_terms);
+    }
+    OnDocumentsChanged();
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status, size_t max_result_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, status, max_result_count);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentStatus status, size_t max_result_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, DocumentFilter::ByStatus(status), max_result_count);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentStatus status, size_t max_result_count) const {
+    return FindTopDocuments(std::execution::par, raw_query, DocumentFilter::ByStatus(status), max_result_count);
+}
+
+SearchResult SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status, const SearchLimits& limits, size_t max_result_count) const {
+    return FindTopDocumentsLimited(std::execution::seq, raw_query, DocumentFilter::ByStatus(status), limits, max_result_count);
+}
+
+SearchResult SearchServer::FindTopDocuments(std::string_view raw_query, const SearchLimits& limits) const {
+    return FindTopDocumentsLimited(std::execution::seq, raw_query, DocumentFilter::ByStatus(DocumentStatus::ACTUAL), limits, MAX_RESULT_DOCUMENT_COUNT);
+}
+
+std::future<SearchResult> SearchServer::FindTopDocumentsAsync(std::string raw_query, DocumentStatus status, SearchLimits limits, size_t max_result_count) const {
+    return FindTopDocumentsAsync(std::move(raw_query), DocumentFilter::ByStatus(status), std::move(limits), max_result_count);
+}
+
+std::future<SearchResult> SearchServer::FindTopDocumentsAsync(std::string raw_query, SearchLimits limits) const {
+    return FindTopDocumentsAsync(std::move(raw_query), DocumentFilter::ByStatus(DocumentStatus::ACTUAL), std::move(limits));
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, const DocumentFilter& filter, size_t max_result_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, filter, max_result_count);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, const DocumentFilter& filter, size_t max_result_count) const {
+    return FindTopDocumentsCached(std::execution::seq, raw_query, filter, {{}, {}, true, filter.statuses, filter.min_rating, filter.max_rating, max_result_count});
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, const DocumentFilter& filter, size_t max_result_count) const {
+    return FindTopDocumentsCached(std::execution::par, raw_query, filter, {{}, {}, true, filter.statuses, filter.min_rating, filter.max_rating, max_result_count});
 }
  
+// Queries scored together and the size of their scratch per document block. The scratch has to stay
+// in cache, otherwise scattering into it costs more than the shared posting traversals save
+const size_t MAX_BATCH_CHUNK_SIZE = 64;
+const size_t BATCH_SCORE_SLOT_LIMIT = 1 << 14;
+
+std::vector<std::vector<Document>> SearchServer::FindTopDocumentsBatch(const std::vector<std::string>& raw_queries) const {
+    // Exceptions must not escape a parallel algorithm, so an invalid query is parked and the first one in input order is rethrown
+    std::vector<Query> queries(raw_queries.size());
+    std::vector<std::exception_ptr> errors(raw_queries.size());
+    std::vector<size_t> positions(raw_queries.size());
+    std::iota(positions.begin(), positions.end(), 0);
+    std::for_each(std::execution::par, positions.begin(), positions.end(), [&](size_t position) {
+        try {
+            std::string_view raw_query = raw_queries[position];
+            queries[position] = ParseQuery(raw_query, true);
+        } catch (...) {
+            errors[position] = std::current_exception();
+        }
+    });
+    for (const auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Queries led by the same longest posting list end up next to each other and share its traversal
+    std::vector<std::pair<size_t, TermId>> hottest_terms(queries.size(), {0, 0});
+    for (size_t position = 0; position < queries.size(); ++position) {
+        for (const TermId term : queries[position].plus_terms) {
+            hottest_terms[position] = std::max(hottest_terms[position], {term_postings_[term].size(), term});
+        }
+    }
+    std::vector<size_t> order(queries.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+        if (hottest_terms[lhs] != hottest_terms[rhs]) {
+            return hottest_terms[rhs] < hottest_terms[lhs];
+        }
+        return std::tie(queries[lhs].plus_terms, queries[lhs].minus_terms, lhs) < std::tie(queries[rhs].plus_terms, queries[rhs].minus_terms, rhs);
+    });
+    // Repeated queries are adjacent now and get scored once
+    std::vector<size_t> distinct;
+    std::vector<std::pair<size_t, size_t>> repeats;
+    for (const size_t position : order) {
+        if (!distinct.empty() && queries[position].plus_terms == queries[distinct.back()].plus_terms
+            && queries[position].minus_terms == queries[distinct.back()].minus_terms) {
+            repeats.emplace_back(position, distinct.back());
+        } else {
+            distinct.push_back(position);
+        }
+    }
+
+    const size_t chunk_size = MAX_BATCH_CHUNK_SIZE;
+    std::vector<size_t> chunk_begins;
+    for (size_t begin = 0; begin < distinct.size(); begin += chunk_size) {
+        chunk_begins.push_back(begin);
+    }
+    std::vector<std::vector<Document>> results(queries.size());
+    std::for_each(std::execution::par, chunk_begins.begin(), chunk_begins.end(), [&](size_t begin) {
+        FindBatchChunk(queries, distinct, begin, std::min(begin + chunk_size, distinct.size()), results);
+    });
+    for (const auto& [position, source] : repeats) {
+        results[position] = results[source];
+    }
+    return results;
+}
+
+void SearchServer::FindBatchChunk(const std::vector<Query>& queries, const std::vector<size_t>& order, size_t begin, size_t end,
+                                  std::vector<std::vector<Document>>& results) const {
+    const size_t query_count = end - begin;
+    // A posting list and the slots of the chunk queries that use its term
+    struct TermRun {
+        PostingList::const_iterator cursor;
+        PostingList::Sentinel last;
+        double inv_document_freq;
+        std::vector<size_t> slots;
+    };
+    const auto make_runs = [&](auto terms_of, bool is_plus) {
+        std::vector<std::pair<TermId, size_t>> uses;
+        for (size_t slot = 0; slot < query_count; ++slot) {
+            for (const TermId term : terms_of(queries[order[begin + slot]])) {
+                uses.emplace_back(term, slot);
+            }
+        }
+        std::sort(uses.begin(), uses.end());
+        std::vector<TermRun> runs;
+        for (size_t i = 0; i < uses.size(); ++i) {
+            if (i == 0 || uses[i].first != uses[i - 1].first) {
+                const PostingList& postings = term_postings_[uses[i].first];
+                runs.push_back({postings.begin(), postings.end(), is_plus ? ComputeWordInverseDocumentFreq(uses[i].first) : 0.0, {}});
+            }
+            runs.back().slots.push_back(uses[i].second);
+        }
+        return runs;
+    };
+    std::vector<TermRun> minus_runs = make_runs([](const Query& query) -> const auto& { return query.minus_terms; }, false);
+    std::vector<TermRun> plus_runs = make_runs([](const Query& query) -> const auto& { return query.plus_terms; }, true);
+
+    // Documents are scored one block at a time, the cursor of every run resumes where the previous block stopped.
+    // Runs are in term order, so each document sums its terms in the same order FindTopDocuments does
+    BatchScoreAccumulator& accumulator = GetBatchScoreAccumulator();
+    const size_t block_size = std::max<size_t>(BATCH_SCORE_SLOT_LIMIT / query_count, 1);
+    const uint64_t* actual_documents = documents_.GetStatusBits(DocumentStatus::ACTUAL);
+    std::vector<TopDocuments> top_documents(query_count, TopDocuments(MAX_RESULT_DOCUMENT_COUNT));
+    for (size_t block_begin = 0; block_begin < documents_.size(); block_begin += block_size) {
+        // Blocks without a posting of any plus run are skipped
+        int next_document = std::numeric_limits<int>::max();
+        for (const TermRun& run : plus_runs) {
+            if (run.cursor != run.last) {
+                next_document = std::min(next_document, run.cursor->document_index);
+            }
+        }
+        if (next_document == std::numeric_limits<int>::max()) {
+            break;
+        }
+        block_begin += (next_document - block_begin) / block_size * block_size;
+        const int block_end = std::min(block_begin + block_size, documents_.size());
+        accumulator.Reset(block_size, query_count);
+        // Every posting of a run inside the block is applied to all queries of the run while it is at hand
+        for (TermRun& run : minus_runs) {
+            run.cursor.SkipTo(block_begin);
+            for (; run.cursor != run.last && run.cursor->document_index < block_end; ++run.cursor) {
+                for (const size_t slot : run.slots) {
+                    accumulator.Exclude(run.cursor->document_index - block_begin, slot);
+                }
+            }
+        }
+        for (TermRun& run : plus_runs) {
+            for (; run.cursor != run.last && run.cursor->document_index < block_end; ++run.cursor) {
+                if (!IsDocumentSelected(actual_documents, run.cursor->document_index)) {
+                    continue;
+                }
+                const double term_score = run.cursor->term_freq * run.inv_document_freq;
+                for (const size_t slot : run.slots) {
+                    accumulator.Add(run.cursor->document_index - block_begin, slot, term_score);
+                }
+            }
+        }
+        for (size_t slot = 0; slot < query_count; ++slot) {
+            for (const int block_index : accumulator.GetTouched(slot)) {
+                const int document_index = block_begin + block_index;
+                top_documents[slot].Push({documents_.GetId(document_index), accumulator.GetScore(block_index, slot), documents_.GetRating(document_index)});
+            }
+        }
+    }
+    for (size_t slot = 0; slot < query_count; ++slot) {
+        results[order[begin + slot]] = top_documents[slot].Extract();
+    }
+}
+
 std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query) const {
     return FindTopDocuments(std::execution::seq, raw_query, DocumentStatus::ACTUAL);
 }
@@ -44,129 +375,473 @@ std::vector<Document> SearchServer::FindTopDocuments(const std::execution::paral
 }
 
 int SearchServer:: GetDocumentCount() const {
-    return documents_.size();
+    return document_to_index_.size();
 }
 
-std::vector<int>::const_iterator SearchServer::begin() const {
-    return document_ids_.begin();
+CorpusStatistics SearchServer::GetCorpusStatistics() const {
+    const int document_count = GetDocumentCount();
+    return {document_count, document_count > 0 ? static_cast<double>(total_word_count_) / document_count : 0.0};
 }
- 
-std::vector<int>::const_iterator SearchServer::end() const {
-    return document_ids_.end();
+
+bool SearchServer::HasDocument(int document_id) const {
+    return document_to_index_.Contains(document_id);
 }
 
-const std::map<std::string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
-    static const std::map<std::string_view, double> empty_;
-    return (!ids_word_to_document_freqs_.count(document_id)) ? empty_ : ids_word_to_document_freqs_.at(document_id);
+int SearchServer::GetDocumentFreq(std::string_view word) const {
+    const auto term = dictionary_.Find(word);
+    return term ? term_postings_[*term].size() : 0;
 }
 
+DocumentIdMap::IdIterator SearchServer::begin() const {
+    return DocumentIdMap::IdIterator(document_to_index_.begin());
+}
+ 
+DocumentIdMap::IdIterator SearchServer::end() const {
+    return DocumentIdMap::IdIterator(document_to_index_.end());
+}
 
-    /*auto storage = GetWordFrequencies(document_id);
-    for (const auto &word : storage) {
-        word_to_document_freqs_.at(word.first).erase(document_id);
+std::map<std::string_view, double> SearchServer::GetWordFrequencies(int document_id) const {
+    const auto index = document_to_index_.Find(document_id);
+    if (index == document_to_index_.end()) {
+        return {};
     }
-    documents_.erase(document_id);
-    document_ids_.emplace(document_id);
-    ids_word_to_document_freqs_.erase(document_id); 
-}*/
-    
- 
-/*void SearchServer::RemoveDocument(const std::execution::sequenced_policy&, int document_id) {
-    RemoveDocument(document_id);
+    std::map<std::string_view, double> word_frequencies;
+    for (const auto [term, term_freq] : document_terms_.Get(index->second)) {
+        word_frequencies.emplace(dictionary_.GetText(term), term_freq);
+    }
+    return word_frequencies;
 }
- 
-void SearchServer::RemoveDocument(const std::execution::parallel_policy&, int document_id) {
-    const std::map<std::string_view, double> &storage = GetWordFrequencies(document_id);
-    std::vector<std::string_view*> stor(storage.size());
-    std::transform(std::execution::par, storage.begin(), storage.end(),
-            stor.begin(),
-            [](std::pair<std::string_view, double> word) {
-                return &word.first;
-            });
-    for_each(std::execution::par, stor.begin(), stor.end(), [&](const std::string_view *word) {
-        word_to_document_freqs_.at(*word).erase(document_id);
-    });
-    documents_.erase(document_id);
-    document_ids_.erase(document_id);
-    ids_word_to_document_freqs_.erase(document_id);
-}*/
-void SearchServer::RemoveDocument(int document_id) {
-    auto storage = std::find(document_ids_.begin(), document_ids_.end(), document_id);
-    if (storage == document_ids_.end()) {
-        return;
-    } else {
-        document_ids_.erase(storage);
+
+std::vector<TermId> SearchServer::GetDocumentTerms(int document_id) const {
+    const auto index = document_to_index_.Find(document_id);
+    if (index == document_to_index_.end()) {
+        return {};
     }
-    documents_.erase(document_id);
-    std::for_each(word_to_document_freqs_.begin(), word_to_document_freqs_.end(), [&](auto& storage) {
-        storage.second.erase(document_id); 
+    const auto terms = document_terms_.Get(index->second);
+    std::vector<TermId> result(terms.size());
+    std::transform(terms.begin(), terms.end(), result.begin(), [](const TermFrequency& term) {
+        return term.term;
     });
+    return result;
+}
+
+void SearchServer::RemoveDocument(int document_id) {
+    RemoveDocument(std::execution::seq, document_id);
 }
  
 void SearchServer::RemoveDocument(const std::execution::sequenced_policy&, int document_id) {
-    RemoveDocument(document_id);
+    SEARCH_METRICS_TIME(REMOVE_DOCUMENT);
+    const auto index = document_to_index_.Find(document_id);
+    if (index == document_to_index_.end()) {
+        return;
+    }
+    const auto terms = document_terms_.Get(index->second);
+    for (const auto [term, _] : terms) {
+        term_postings_[term].Erase(index->second);
+        ReleaseTermIfUnused(term);
+    }
+    document_terms_.Clear(index->second);
+    total_word_count_ -= documents_.GetWordCount(index->second);
+    documents_.Remove(index->second);
+    document_to_index_.Erase(document_id);
+    CompactDocumentsIfSparse();
+    OnDocumentsChanged();
 }
 
 void SearchServer::RemoveDocument(const std::execution::parallel_policy&, int document_id) {
-    auto storage = std::find(std::execution::par, document_ids_.begin(), document_ids_.end(), document_id);
-    if (storage == document_ids_.end()) {
+    SEARCH_METRICS_TIME(REMOVE_DOCUMENT);
+    const auto index = document_to_index_.Find(document_id);
+    if (index == document_to_index_.end()) {
         return;
-    } else {
-        document_ids_.erase(storage);
     }
-    documents_.erase(document_id);
-    std::for_each(std::execution::par, word_to_document_freqs_.begin(), word_to_document_freqs_.end(), [&](auto& storage) { 
-        storage.second.erase(document_id); 
+    const auto terms = document_terms_.Get(index->second);
+    std::for_each(std::execution::par, terms.begin(), terms.end(), [this, document_index = index->second](const TermFrequency& term) {
+        term_postings_[term.term].Erase(document_index);
     });
+    for (const auto [term, _] : terms) {
+        ReleaseTermIfUnused(term);
+    }
+    document_terms_.Clear(index->second);
+    total_word_count_ -= documents_.GetWordCount(index->second);
+    documents_.Remove(index->second);
+    document_to_index_.Erase(document_id);
+    CompactDocumentsIfSparse();
+    OnDocumentsChanged();
 }
-    /*if ((document_id < 0) || (documents_.count(document_id) <= 0)) {
-        throw std::invalid_argument("Non-existent document ID"s);
+
+void SearchServer::RemoveDocuments(const std::vector<int>& document_ids) {
+    RemoveDocuments(std::execution::seq, document_ids);
+}
+
+void SearchServer::RemoveDocuments(const std::execution::sequenced_policy&, const std::vector<int>& document_ids) {
+    auto removed = CollectRemovedPostings(document_ids);
+    for (auto& [term, document_indexes] : removed) {
+        term_postings_[term].Erase(document_indexes);
     }
-    const auto result = ParseQuery(raw_query);
-    std::vector<std::string> matched_words;
-    for (const std::string& word : result.minus_words) {
-            if (word_to_document_freqs_.count(word) == 0) {
-                continue;
-            }
-            if (word_to_document_freqs_.at(word).count(document_id)) {
-                 return {{}, documents_.at(document_id).status};
-            }
+    FinishRemoval(document_ids, removed);
+}
+
+void SearchServer::RemoveDocuments(const std::execution::parallel_policy&, const std::vector<int>& document_ids) {
+    auto removed = CollectRemovedPostings(document_ids);
+    std::for_each(std::execution::par, removed.begin(), removed.end(), [this](auto& word_removal) {
+        term_postings_[word_removal.first].Erase(word_removal.second);
+    });
+    FinishRemoval(document_ids, removed);
+}
+
+std::vector<SearchServer::WordRemoval> SearchServer::CollectRemovedPostings(const std::vector<int>& document_ids) {
+    std::vector<std::pair<TermId, int>> removed_postings;
+    for (const int document_id : document_ids) {
+        const auto index = document_to_index_.Find(document_id);
+        if (index == document_to_index_.end()) {
+            continue;
+        }
+        for (const auto [term, _] : document_terms_.Get(index->second)) {
+            removed_postings.emplace_back(term, index->second);
+        }
+    }
+    std::sort(removed_postings.begin(), removed_postings.end());
+    removed_postings.erase(std::unique(removed_postings.begin(), removed_postings.end()), removed_postings.end());
+    std::vector<WordRemoval> removed;
+    for (const auto& [term, document_index] : removed_postings) {
+        if (removed.empty() || removed.back().first != term) {
+            removed.emplace_back(term, std::vector<int>());
+        }
+        removed.back().second.push_back(document_index);
+    }
+    return removed;
+}
+
+void SearchServer::FinishRemoval(const std::vector<int>& document_ids, const std::vector<WordRemoval>& removed) {
+    for (const auto& [term, _] : removed) {
+        ReleaseTermIfUnused(term);
+    }
+    for (const int document_id : document_ids) {
+        const auto index = document_to_index_.Find(document_id);
+        if (index == document_to_index_.end()) {
+            continue;
+        }
+        document_terms_.Clear(index->second);
+        total_word_count_ -= documents_.GetWordCount(index->second);
+        documents_.Remove(index->second);
+        document_to_index_.Erase(document_id);
+    }
+    CompactDocumentsIfSparse();
+    OnDocumentsChanged();
+}
+
+void SearchServer::CompactDocumentsIfSparse() {
+    const size_t removed_count = documents_.size() - document_to_index_.size();
+    if (removed_count < COMPACTION_MIN_REMOVED_DOCUMENTS || removed_count * 4 < documents_.size()) {
+        return;
+    }
+    std::vector<int> live_indexes;
+    live_indexes.reserve(document_to_index_.size());
+    for (const auto& [_, index] : document_to_index_) {
+        live_indexes.push_back(index);
+    }
+    // The live documents keep their order, so posting lists stay sorted
+    std::sort(live_indexes.begin(), live_indexes.end());
+    std::vector<int> new_indexes(documents_.size(), -1);
+    DocumentAttributes documents;
+    documents.reserve(live_indexes.size());
+    for (const int index : live_indexes) {
+        new_indexes[index] = documents.Add(documents_.GetId(index), documents_.GetRating(index), documents_.GetStatus(index), documents_.GetWordCount(index));
+    }
+    document_to_index_.Renumber(new_indexes);
+    documents_ = std::move(documents);
+    const bool terms_compressed = document_terms_.IsCompressed();
+    document_terms_.Keep(live_indexes);
+
+    // Compressed lists and documents are decoded to be renumbered and compressed again against the new inverse word counts
+    auto inv_word_counts = std::make_shared<std::vector<double>>(documents_.size());
+    for (size_t index = 0; index < documents_.size(); ++index) {
+        (*inv_word_counts)[index] = 1.0 / documents_.GetWordCount(index);
+    }
+    std::for_each(std::execution::par, term_postings_.begin(), term_postings_.end(), [&new_indexes, &inv_word_counts](PostingList& postings) {
+        const bool compressed = postings.IsCompressed();
+        postings.Renumber(new_indexes);
+        if (compressed) {
+            postings.Compress(inv_word_counts);
         }
-        for (const std::string& word : result.plus_words) {
-            if (word_to_document_freqs_.count(word) == 0) {
-                continue;
+    });
+    if (terms_compressed) {
+        document_terms_.Compress(inv_word_counts);
+    }
+}
+
+void SearchServer::ReleaseTermIfUnused(TermId term) {
+    if (term_postings_[term].empty()) {
+        // Drops borrowed snapshot storage as well
+        term_postings_[term] = PostingList();
+        dictionary_.Release(term);
+    }
+}
+
+void SearchServer::SaveSnapshot(const std::string& path) const {
+    if (!IsLittleEndianHost()) {
+        throw std::runtime_error("Snapshots are supported on little-endian hosts only"s);
+    }
+    // Removed documents leave holes in the index space, the snapshot renumbers live ones densely.
+    // The renumbering keeps the order, so posting lists stay sorted
+    std::vector<int> snapshot_indexes(documents_.size(), -1);
+    std::vector<SnapshotDocument> documents;
+    for (size_t index = 0; index < documents_.size(); ++index) {
+        const int document_id = documents_.GetId(index);
+        const auto live = document_to_index_.Find(document_id);
+        if (live != document_to_index_.end() && live->second == static_cast<int>(index)) {
+            snapshot_indexes[index] = documents.size();
+            documents.push_back({document_id, documents_.GetRating(index), static_cast<int32_t>(documents_.GetStatus(index)), documents_.GetWordCount(index)});
+        }
+    }
+
+    SnapshotHeader header{};
+    SnapshotWriter writer(path);
+    header.arena_offset = writer.GetOffset();
+    std::vector<SnapshotString> stop_words;
+    for (const std::string& stop_word : stop_words_) {
+        stop_words.push_back({writer.GetOffset() - header.arena_offset, stop_word.size()});
+        writer.Write(stop_word.data(), stop_word.size());
+    }
+    // Released term ids are skipped, the snapshot numbers terms densely in id order
+    std::vector<TermId> snapshot_terms(term_postings_.size());
+    std::vector<SnapshotWord> words;
+    std::vector<PostingBlockBounds> blocks;
+    uint64_t posting_count = 0;
+    for (TermId term = 0; term < term_postings_.size(); ++term) {
+        const auto& postings = term_postings_[term];
+        if (postings.empty()) {
+            continue;
+        }
+        snapshot_terms[term] = words.size();
+        const std::string_view word = dictionary_.GetText(term);
+        words.push_back({{writer.GetOffset() - header.arena_offset, word.size()}, posting_count, postings.size(), blocks.size()});
+        writer.Write(word.data(), word.size());
+        posting_count += postings.size();
+        size_t position = 0;
+        for (const Posting& posting : postings) {
+            if (position++ % PostingList::BLOCK_SIZE == 0) {
+                blocks.push_back({0, 0.0});
             }
-            if (word_to_document_freqs_.at(word).count(document_id)) {
-                matched_words.push_back(word);
+            blocks.back().last_document_index = snapshot_indexes[posting.document_index];
+            blocks.back().max_term_freq = std::max(blocks.back().max_term_freq, posting.term_freq);
+        }
+    }
+    header.arena_size = writer.GetOffset() - header.arena_offset;
+    writer.Align();
+
+    header.stop_word_count = stop_words.size();
+    header.stop_words_offset = writer.GetOffset();
+    writer.Write(stop_words.data(), stop_words.size() * sizeof(SnapshotString));
+    writer.Align();
+
+    header.word_count = words.size();
+    header.words_offset = writer.GetOffset();
+    writer.Write(words.data(), words.size() * sizeof(SnapshotWord));
+
+    header.block_count = blocks.size();
+    header.blocks_offset = writer.GetOffset();
+    for (const PostingBlockBounds& bounds : blocks) {
+        PostingBlockBounds stored;
+        std::memset(&stored, 0, sizeof(stored));
+        stored.last_document_index = bounds.last_document_index;
+        stored.max_term_freq = bounds.max_term_freq;
+        writer.Write(&stored, sizeof(stored));
+    }
+
+    header.document_count = documents.size();
+    header.documents_offset = writer.GetOffset();
+    writer.Write(documents.data(), documents.size() * sizeof(SnapshotDocument));
+
+    header.term_offsets_offset = writer.GetOffset();
+    uint64_t term_offset = 0;
+    writer.Write(&term_offset, sizeof(term_offset));
+    for (size_t index = 0; index < documents_.size(); ++index) {
+        if (snapshot_indexes[index] >= 0) {
+            term_offset += document_terms_.Get(index).size();
+            writer.Write(&term_offset, sizeof(term_offset));
+        }
+    }
+
+    if (inverse_document_freqs_.IsFrozen()) {
+        header.flags |= SNAPSHOT_FROZEN_IDFS;
+        header.idfs_offset = writer.GetOffset();
+        for (TermId term = 0; term < term_postings_.size(); ++term) {
+            if (!term_postings_[term].empty()) {
+                const double inv_document_freq = ComputeWordInverseDocumentFreq(term);
+                writer.Write(&inv_document_freq, sizeof(inv_document_freq));
             }
         }
- 
-        return {matched_words, documents_.at(document_id).status};
-}*/
+    }
+    header.checksum = writer.TakeChecksum();
+
+    header.posting_count = posting_count;
+    header.postings_offset = writer.GetOffset();
+    for (const auto& postings : term_postings_) {
+        for (const Posting& posting : postings) {
+            Posting stored;
+            std::memset(&stored, 0, sizeof(stored));
+            stored.document_index = snapshot_indexes[posting.document_index];
+            stored.term_freq = posting.term_freq;
+            writer.Write(&stored, sizeof(stored));
+        }
+    }
+
+    header.terms_offset = writer.GetOffset();
+    for (size_t index = 0; index < documents_.size(); ++index) {
+        if (snapshot_indexes[index] < 0) {
+            continue;
+        }
+        for (const auto [term, term_freq] : document_terms_.Get(index)) {
+            TermFrequency stored;
+            std::memset(&stored, 0, sizeof(stored));
+            stored.term = snapshot_terms[term];
+            stored.term_freq = term_freq;
+            writer.Write(&stored, sizeof(stored));
+        }
+    }
+    header.postings_checksum = writer.TakeChecksum();
+    writer.Finish(header);
+}
+
+SearchServer SearchServer::LoadSnapshot(const std::string& path, bool verify_checksum) {
+    if (!IsLittleEndianHost()) {
+        throw std::runtime_error("Snapshots are supported on little-endian hosts only"s);
+    }
+    auto file = std::make_shared<const MappedFile>(path);
+    const auto corrupted = [&path]() {
+        return std::runtime_error("Snapshot file "s + path + " is corrupted"s);
+    };
+    SnapshotHeader header;
+    if (file->size() < sizeof(header)) {
+        throw corrupted();
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.file_size != file->size()) {
+        throw corrupted();
+    }
+    if (header.version != SNAPSHOT_VERSION) {
+        throw std::runtime_error("Unsupported snapshot version "s + std::to_string(header.version));
+    }
+    const auto section_fits = [&header](uint64_t offset, uint64_t count, size_t entry_size) {
+        return offset % 8 == 0 && offset <= header.file_size && count <= (header.file_size - offset) / entry_size;
+    };
+    if (!section_fits(header.arena_offset, header.arena_size, 1)
+        || !section_fits(header.stop_words_offset, header.stop_word_count, sizeof(SnapshotString))
+        || !section_fits(header.words_offset, header.word_count, sizeof(SnapshotWord))
+        || !section_fits(header.blocks_offset, header.block_count, sizeof(PostingBlockBounds))
+        || !section_fits(header.documents_offset, header.document_count, sizeof(SnapshotDocument))
+        || header.document_count == std::numeric_limits<uint64_t>::max()
+        || !section_fits(header.term_offsets_offset, header.document_count + 1, sizeof(uint64_t))
+        || ((header.flags & SNAPSHOT_FROZEN_IDFS) && !section_fits(header.idfs_offset, header.word_count, sizeof(double)))
+        || !section_fits(header.postings_offset, header.posting_count, sizeof(Posting))
+        || !section_fits(header.terms_offset, header.posting_count, sizeof(TermFrequency))
+        || header.postings_offset < sizeof(header)) {
+        throw corrupted();
+    }
+    // The tables are checked on every load, the postings and terms only when asked to, as that reads them all
+    if (UpdateSnapshotChecksum(SNAPSHOT_CHECKSUM_SEED, file->data() + sizeof(header), header.postings_offset - sizeof(header)) != header.checksum
+        || (verify_checksum
+            && UpdateSnapshotChecksum(SNAPSHOT_CHECKSUM_SEED, file->data() + header.postings_offset, header.file_size - header.postings_offset) != header.postings_checksum)) {
+        throw corrupted();
+    }
+
+    const char* arena = file->data() + header.arena_offset;
+    const auto arena_string = [&](const SnapshotString& text) {
+        if (text.offset > header.arena_size || text.size > header.arena_size - text.offset) {
+            throw corrupted();
+        }
+        return std::string_view(arena + text.offset, text.size);
+    };
+    const auto* stop_word_table = reinterpret_cast<const SnapshotString*>(file->data() + header.stop_words_offset);
+    std::vector<std::string_view> stop_words;
+    for (uint64_t i = 0; i < header.stop_word_count; ++i) {
+        stop_words.push_back(arena_string(stop_word_table[i]));
+    }
+    SearchServer server(stop_words);
+
+    const auto* documents = reinterpret_cast<const SnapshotDocument*>(file->data() + header.documents_offset);
+    server.documents_.reserve(header.document_count);
+    for (uint64_t index = 0; index < header.document_count; ++index) {
+        const SnapshotDocument& document = documents[index];
+        if (document.word_count < 0 || document.status < 0 || document.status >= DOCUMENT_STATUS_COUNT) {
+            throw corrupted();
+        }
+        server.documents_.Add(document.id, document.rating, static_cast<DocumentStatus>(document.status), document.word_count);
+        server.total_word_count_ += document.word_count;
+        if (!server.document_to_index_.Insert(document.id, index)) {
+            throw corrupted();
+        }
+    }
+
+    const auto* word_table = reinterpret_cast<const SnapshotWord*>(file->data() + header.words_offset);
+    const auto* blocks = reinterpret_cast<const PostingBlockBounds*>(file->data() + header.blocks_offset);
+    const auto* postings = reinterpret_cast<const Posting*>(file->data() + header.postings_offset);
+    for (uint64_t i = 0; i < header.word_count; ++i) {
+        const SnapshotWord& word = word_table[i];
+        if (word.postings_offset > header.posting_count || word.postings_count > header.posting_count - word.postings_offset
+            || word.blocks_offset > header.block_count
+            || (word.postings_count + PostingList::BLOCK_SIZE - 1) / PostingList::BLOCK_SIZE > header.block_count - word.blocks_offset) {
+            throw corrupted();
+        }
+        const TermId term = server.dictionary_.InternBorrowed(arena_string(word.text));
+        if (term != i) {
+            throw corrupted();
+        }
+        server.term_postings_.push_back(PostingList::Borrow(postings + word.postings_offset, word.postings_count, blocks + word.blocks_offset));
+    }
+
+    const auto* term_offsets = reinterpret_cast<const uint64_t*>(file->data() + header.term_offsets_offset);
+    if (term_offsets[0] != 0 || term_offsets[header.document_count] != header.posting_count) {
+        throw corrupted();
+    }
+    for (uint64_t index = 0; index < header.document_count; ++index) {
+        if (term_offsets[index] > term_offsets[index + 1]) {
+            throw corrupted();
+        }
+    }
+    server.document_terms_ = ForwardIndex::Borrow(reinterpret_cast<const TermFrequency*>(file->data() + header.terms_offset), term_offsets,
+                                                  header.document_count);
+    server.inverse_document_freqs_.Resize(header.word_count);
+    if (header.flags & SNAPSHOT_FROZEN_IDFS) {
+        const auto* inv_document_freqs = reinterpret_cast<const double*>(file->data() + header.idfs_offset);
+        for (TermId term = 0; term < header.word_count; ++term) {
+            server.inverse_document_freqs_.Set(term, inv_document_freqs[term]);
+        }
+        server.inverse_document_freqs_.Freeze();
+    }
+    server.snapshot_ = std::move(file);
+    return server;
+}
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::string_view raw_query, int document_id) const {
-    if ((document_id < 0) || (documents_.count(document_id) <= 0)) {
+    SEARCH_METRICS_TIME(MATCH_DOCUMENT);
+    const auto index = document_to_index_.Find(document_id);
+    if ((document_id < 0) || (index == document_to_index_.end())) {
         throw std::invalid_argument("Non-existent document ID"s);
     }
+    const DocumentStatus status = documents_.GetStatus(index->second);
     const auto result = ParseQuery(raw_query);
+    const auto has_term = [terms = document_terms_.Get(index->second)](TermId term) {
+        const auto found = std::lower_bound(terms.begin(), terms.end(), term, [](const TermFrequency& frequency, TermId term) {
+            return frequency.term < term;
+        });
+        return found != terms.end() && found->term == term;
+    };
     std::vector<std::string_view> matched_words;
-    for (auto word : result.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            return {{}, documents_.at(document_id).status};
+    for (const TermId term : result.minus_terms) {
+        if (has_term(term)) {
+            return {std::vector<std::string_view>{}, status};
         }
     }
-    for (auto word : result.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            matched_words.push_back(word);
+    for (const TermId term : result.plus_terms) {
+        if (has_term(term)) {
+            matched_words.push_back(dictionary_.GetText(term));
         }
     }
-    return {matched_words, documents_.at(document_id).status};
+    // Terms come in id order, the words are returned sorted like the query words they match
+    std::sort(matched_words.begin(), matched_words.end());
+    return {matched_words, status};
 }
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::sequenced_policy&, std::string_view raw_query, int document_id) const {
@@ -174,47 +849,138 @@ std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDoc
 }
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::parallel_policy&, std::string_view raw_query, int document_id) const {
-    if ((document_id < 0) || (documents_.count(document_id) <= 0)) {
+    SEARCH_METRICS_TIME(MATCH_DOCUMENT);
+    const auto index = document_to_index_.Find(document_id);
+    if ((document_id < 0) || (index == document_to_index_.end())) {
         throw std::invalid_argument("Non-existent document ID"s);
     }
+    const DocumentStatus status = documents_.GetStatus(index->second);
     const auto& result = ParseQuery(raw_query);
-    const auto& storage = [this, document_id](std::string_view word) {
-        const auto stor = word_to_document_freqs_.find(word);
-        return stor != word_to_document_freqs_.end() && stor->second.count(document_id);        
+    const auto terms = document_terms_.Get(index->second);
+    const auto& storage = [&terms](TermId term) {
+        const auto found = std::lower_bound(terms.begin(), terms.end(), term, [](const TermFrequency& frequency, TermId term) {
+            return frequency.term < term;
+        });
+        return found != terms.end() && found->term == term;
     };
-    if (std::any_of(std::execution::par, result.minus_words.begin(), result.minus_words.end(), storage)) {
-        return {{}, documents_.at(document_id).status};
-    }
-    std::vector<std::string_view> matched_words(result.plus_words.size());
-    auto end = std::copy_if(std::execution::par, result.plus_words.begin(), result.plus_words.end(), matched_words.begin(), storage);
-    std::sort(matched_words.begin(), end);
-    end = std::unique(std::execution::par, matched_words.begin(), end);
-    matched_words.erase(end, matched_words.end());
-    return {matched_words, documents_.at(document_id).status};
-}/*
-    if ((document_id < 0) || (documents_.count(document_id) <= 0)) {
-        throw std::invalid_argument("Non-existent document ID"s);
+    if (std::any_of(std::execution::par, result.minus_terms.begin(), result.minus_terms.end(), storage)) {
+        return {std::vector<std::string_view>{}, status};
     }
-    
-    const auto& result = ParseQuery(raw_query, false);    
- 
-    const auto& stor = [this, document_id](const std::string& word) {
-        const auto storage = word_to_document_freqs_.find(word);
-        return storage != word_to_document_freqs_.end() && 
-                        storage->second.count(document_id);        
-    };
- 
-    if (std::any_of(std::execution::par, result.minus_words.begin(), result.minus_words.end(), stor)) {
-        return {{}, documents_.at(document_id).status};
+    std::pmr::vector<TermId> matched_terms(result.plus_terms.size(), result.memory.GetResource());
+    auto end = std::copy_if(std::execution::par, result.plus_terms.begin(), result.plus_terms.end(), matched_terms.begin(), storage);
+    std::vector<std::string_view> matched_words;
+    matched_words.reserve(end - matched_terms.begin());
+    std::transform(matched_terms.begin(), end, std::back_inserter(matched_words), [this](TermId term) {
+        return dictionary_.GetText(term);
+    });
+    std::sort(matched_words.begin(), matched_words.end());
+    return {matched_words, status};
+}
+
+DocumentMatches SearchServer::MatchDocuments(std::string_view raw_query, const std::vector<int>& document_ids) const {
+    return MatchDocumentsImpl(std::execution::seq, raw_query, document_ids);
+}
+
+DocumentMatches SearchServer::MatchDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, const std::vector<int>& document_ids) const {
+    return MatchDocumentsImpl(std::execution::seq, raw_query, document_ids);
+}
+
+DocumentMatches SearchServer::MatchDocuments(const std::execution::parallel_policy&, std::string_view raw_query, const std::vector<int>& document_ids) const {
+    return MatchDocumentsImpl(std::execution::par, raw_query, document_ids);
+}
+
+template <typename ExecutionPolicy>
+DocumentMatches SearchServer::MatchDocumentsImpl(const ExecutionPolicy& policy, std::string_view raw_query, const std::vector<int>& document_ids) const {
+    SEARCH_METRICS_TIME(MATCH_DOCUMENTS);
+    std::vector<int> document_indexes;
+    document_indexes.reserve(document_ids.size());
+    for (const int document_id : document_ids) {
+        const auto index = document_to_index_.Find(document_id);
+        if ((document_id < 0) || (index == document_to_index_.end())) {
+            throw std::invalid_argument("Non-existent document ID"s);
+        }
+        document_indexes.push_back(index->second);
     }
-    std::vector<std::string> matched_words(result.plus_words.size());
-    auto end = std::copy_if(std::execution::par, result.plus_words.begin(), result.plus_words.end(), matched_words.begin(), stor);
-    std::sort(matched_words.begin(), end);
-    end = std::unique(std::execution::par, matched_words.begin(), end);
-    matched_words.erase(end, matched_words.end());
-    return {matched_words, documents_.at(document_id).status};
-}*/
+    const auto query = ParseQuery(raw_query);
+    // Every document has room for all plus terms, so documents are matched independently without allocations
+    const size_t slot_size = query.plus_terms.size();
+    std::pmr::memory_resource* const scratch = query.memory.GetResource();
+    std::pmr::vector<TermId> matched_terms(document_ids.size() * slot_size, scratch);
+    std::pmr::vector<size_t> matched_counts(document_ids.size(), scratch);
+    std::pmr::vector<size_t> positions(document_ids.size(), scratch);
+    std::iota(positions.begin(), positions.end(), 0);
+    std::for_each(policy, positions.begin(), positions.end(), [&](size_t position) {
+        matched_counts[position] = MatchTerms(query, document_indexes[position], matched_terms.data() + position * slot_size);
+    });
 
+    DocumentMatches matches;
+    matches.offsets.reserve(document_ids.size() + 1);
+    matches.offsets.push_back(0);
+    matches.statuses.reserve(document_ids.size());
+    for (size_t position = 0; position < document_ids.size(); ++position) {
+        matches.offsets.push_back(matches.offsets.back() + matched_counts[position]);
+        matches.statuses.push_back(documents_.GetStatus(document_indexes[position]));
+    }
+    matches.words.resize(matches.offsets.back());
+    std::for_each(policy, positions.begin(), positions.end(), [&](size_t position) {
+        const auto terms = matched_terms.begin() + position * slot_size;
+        const auto words = matches.words.begin() + matches.offsets[position];
+        std::transform(terms, terms + matched_counts[position], words, [this](TermId term) {
+            return dictionary_.GetText(term);
+        });
+        std::sort(words, words + matched_counts[position]);
+    });
+    return matches;
+}
+
+size_t SearchServer::MatchTerms(const Query& query, int document_index, TermId* matched_terms) const {
+    const auto terms = document_terms_.Get(document_index);
+    const auto has_term = [&terms](TermId term) {
+        const auto found = std::lower_bound(terms.begin(), terms.end(), term, [](const TermFrequency& frequency, TermId term) {
+            return frequency.term < term;
+        });
+        return found != terms.end() && found->term == term;
+    };
+    if (std::any_of(query.minus_terms.begin(), query.minus_terms.end(), has_term)) {
+        return 0;
+    }
+    size_t matched_count = 0;
+    auto position = terms.begin();
+    // A few query terms gallop through a long document, otherwise both sorted lists are merged
+    if (query.plus_terms.size() * 4 < terms.size()) {
+        for (const TermId term : query.plus_terms) {
+            size_t step = 1;
+            auto bound = position;
+            while (terms.end() - bound > static_cast<std::ptrdiff_t>(step) && bound[step].term < term) {
+                bound += step;
+                step *= 2;
+            }
+            position = std::lower_bound(bound, terms.end() - bound > static_cast<std::ptrdiff_t>(step) ? bound + step + 1 : terms.end(), term,
+                                        [](const TermFrequency& frequency, TermId term) {
+                return frequency.term < term;
+            });
+            if (position == terms.end()) {
+                break;
+            }
+            if (position->term == term) {
+                matched_terms[matched_count++] = term;
+            }
+        }
+        return matched_count;
+    }
+    for (const TermId term : query.plus_terms) {
+        while (position != terms.end() && position->term < term) {
+            ++position;
+        }
+        if (position == terms.end()) {
+            break;
+        }
+        if (position->term == term) {
+            matched_terms[matched_count++] = term;
+        }
+    }
+    return matched_count;
+}
 
 bool SearchServer:: IsStopWord(std::string_view word) const {
         return stop_words_.count(word) > 0;
@@ -226,17 +992,29 @@ bool SearchServer::IsValidWord(std::string_view word) {
     });
 }
 
-std::vector<std::string_view> SearchServer::SplitIntoWordsNoStop(std::string_view text) const {
-    std::vector<std::string_view> words;
-    for (std::string_view& word : SplitIntoWords(text)) {        
-        if (!IsValidWord(word)) {
-            throw std::invalid_argument("Word "s + std::string(word) + " is invalid"s);
-        }
-        if (!IsStopWord(word)) {
-            words.push_back(word);
+std::vector<std::pair<std::string_view, double>> SearchServer::ComputeWordFrequencies(std::string_view text, int& word_count) const {
+    SplitText& split_text = GetSplitText();
+    SplitIntoWords(text, separators_, split_text);
+    auto& words = split_text.words;
+    if (split_text.first_invalid_word < words.size()) {
+        throw std::invalid_argument("Word "s + std::string(words[split_text.first_invalid_word]) + " is invalid"s);
+    }
+    words.erase(std::remove_if(words.begin(), words.end(), [this](std::string_view word) {
+        return IsStopWord(word);
+    }), words.end());
+    word_count = words.size();
+    std::sort(words.begin(), words.end());
+    std::vector<std::pair<std::string_view, double>> word_frequencies;
+    const double inv_word_count = 1.0 / words.size();
+    for (size_t begin = 0; begin < words.size();) {
+        size_t end = begin + 1;
+        while (end < words.size() && words[end] == words[begin]) {
+            ++end;
         }
+        word_frequencies.emplace_back(words[begin], (end - begin) * inv_word_count);
+        begin = end;
     }
-    return words;
+    return word_frequencies;
 }
 
 int SearchServer:: ComputeAverageRating(const std::vector<int>& ratings) {
@@ -247,7 +1025,40 @@ int SearchServer:: ComputeAverageRating(const std::vector<int>& ratings) {
     return rating_sum / static_cast<int>(ratings.size());
 }
 
-SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view& text) const {
+TermId SearchServer::InternWord(std::string_view word) {
+    const TermId term = dictionary_.Intern(word);
+    if (term >= term_postings_.size()) {
+        term_postings_.resize(term + 1);
+        inverse_document_freqs_.Resize(term + 1);
+    }
+    if (term_postings_[term].empty()) {
+        // New word or a reused id of a released one
+        inverse_document_freqs_.Reset(term);
+    }
+    return term;
+}
+
+ScoreAccumulator& SearchServer::GetScoreAccumulator() {
+    static thread_local ScoreAccumulator accumulator;
+    return accumulator;
+}
+
+BatchScoreAccumulator& SearchServer::GetBatchScoreAccumulator() {
+    static thread_local BatchScoreAccumulator accumulator;
+    return accumulator;
+}
+
+SplitText& SearchServer::GetSplitText() {
+    static thread_local SplitText split_text;
+    return split_text;
+}
+
+QueryArena& SearchServer::GetQueryArena() {
+    static thread_local QueryArena arena;
+    return arena;
+}
+
+SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view& text, bool is_valid) const {
     if (text.empty()) {
         throw std::invalid_argument("Query word is empty"s);
     }
@@ -256,65 +1067,98 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view& text) con
         is_minus = true;
         text = text.substr(1);
     }
-    if (text.empty() || text[0] == '-' || !IsValidWord(text)) {
+    if (text.empty() || text[0] == '-' || !is_valid) {
         throw std::invalid_argument("Query word "s + std::string(text) + " is invalid");
     }
     return {text, is_minus, IsStopWord(text)};
 }
 
-/*SearchServer::Query SearchServer::ParseQuery(std::string_view& text, const std::execution::sequenced_policy&) const {
-    Query result;
-    result = ParseQuery(text);
-    std::sort(std::execution::par, result.minus_words.begin(), result.minus_words.end());
-    std::sort(std::execution::par, result.plus_words.begin(), result.plus_words.end());
-    result.minus_words.erase(std::unique(result.minus_words.begin(), result.minus_words.end()), result.minus_words.end());
-    result.plus_words.erase(std::unique(result.plus_words.begin(), result.plus_words.end()), result.plus_words.end());
+SearchServer::Query SearchServer::ParseQuery(std::string_view& text, bool leaves_thread) const {
+    SEARCH_METRICS_TIME(PARSE_QUERY);
+    Query result(leaves_thread ? QueryArena::Lease() : QueryArena::Lease(GetQueryArena()));
+    SplitText& split_text = GetSplitText();
+    SplitIntoWords(text, separators_, split_text);
+    // Growing a vector in the arena would leave every smaller copy behind
+    result.plus_terms.reserve(split_text.words.size());
+    result.minus_terms.reserve(split_text.words.size());
+    for (size_t position = 0; position < split_text.words.size(); ++position) {
+        std::string_view word = split_text.words[position];
+        const auto query_word = ParseQueryWord(word, position != split_text.first_invalid_word);
+        if (query_word.is_stop) {
+            continue;
+        }
+        // A word missing from the index can neither match nor exclude anything
+        const auto term = dictionary_.Find(query_word.data);
+        if (!term) {
+            continue;
+        }
+        if (query_word.is_minus) {
+            result.minus_terms.push_back(*term);
+        } else {
+            result.plus_terms.push_back(*term);
+        }
+    }
+    std::sort(result.minus_terms.begin(), result.minus_terms.end());
+    std::sort(result.plus_terms.begin(), result.plus_terms.end());
+    result.minus_terms.erase(std::unique(result.minus_terms.begin(), result.minus_terms.end()), result.minus_terms.end());
+    result.plus_terms.erase(std::unique(result.plus_terms.begin(), result.plus_terms.end()), result.plus_terms.end());
     return result;
-}*/
+}
+
+double SearchServer:: ComputeWordInverseDocumentFreq(TermId term) const {
+       return inverse_document_freqs_.Get(term, GetDocumentCount(), term_postings_[term].size());
+}
 
+void SearchServer::WeighQuery(Query& query) const {
+    SEARCH_METRICS_TIME(WEIGH_QUERY);
+    query.plus_term_weights.reserve(query.plus_terms.size());
+    for (const TermId term : query.plus_terms) {
+        query.plus_term_weights.push_back(ComputeWordInverseDocumentFreq(term));
+    }
+}
 
+void SearchServer::OnDocumentsChanged() {
+    inverse_document_freqs_.Invalidate();
+    result_cache_.Invalidate();
+}
 
-SearchServer::Query SearchServer::ParseQuery(std::string_view& text) const {
-    Query result;
-    for (std::string_view& word : SplitIntoWords(text)) {
-        const auto query_word = ParseQueryWord(word);
-        if (!query_word.is_stop) {
-            if (query_word.is_minus) {
-                result.minus_words.push_back(query_word.data);
-            } else {
-                result.plus_words.push_back(query_word.data);
-            }
+void SearchServer::FreezeInverseDocumentFreqs() {
+    for (TermId term = 0; term < term_postings_.size(); ++term) {
+        if (!term_postings_[term].empty()) {
+            ComputeWordInverseDocumentFreq(term);
         }
     }
-    std::sort(std::execution::par, result.minus_words.begin(), result.minus_words.end());
-    std::sort(std::execution::par, result.plus_words.begin(), result.plus_words.end());
-    result.minus_words.erase(std::unique(result.minus_words.begin(), result.minus_words.end()), result.minus_words.end());
-    result.plus_words.erase(std::unique(result.plus_words.begin(), result.plus_words.end()), result.plus_words.end());
-    return result;
+    inverse_document_freqs_.Freeze();
 }
 
-/*
-SearchServer::Query SearchServer::ParseQuery(std::execution::parallel_policy, std::string_view text) const {
-    auto&& words = SplitIntoWords(text);
-    Query query;
-    query.minus_words.reserve(words.size());
-    query.plus_words.reserve(words.size());
-    std::for_each(std::execution::par, words.begin(), words.end(),
-                  [this, &query](std::string_view word) {
-                      const QueryWord query_word = ParseQueryWord(word);
-                      if (!query_word.is_stop) {
-                          if (query_word.is_minus) {
-                              query.minus_words.push_back(query_word.data);
-                          } else {
-                              query.plus_words.push_back(query_word.data);
-                          }
-                      }
-                  });
- 
-    return query;
-}*/
+void SearchServer::UnfreezeInverseDocumentFreqs() {
+    inverse_document_freqs_.Unfreeze();
+    result_cache_.Invalidate();
+}
+
+void SearchServer::SetScorePruning(bool enabled) {
+    score_pruning_ = enabled;
+}
+
+void SearchServer::SetWordSeparators(std::string_view separators) {
+    separators_ = WordSeparators(separators);
+}
+
+void SearchServer::SetResultCacheCapacity(size_t capacity) {
+    result_cache_.Reset(capacity);
+}
 
-    // Existence required
-double SearchServer:: ComputeWordInverseDocumentFreq(std::string_view& word) const {
-       return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+ResultCacheStats SearchServer::GetResultCacheStats() const {
+    return result_cache_.GetStats();
+}
+
+void SearchServer::CompressPostings() {
+    auto inv_word_counts = std::make_shared<std::vector<double>>(documents_.size());
+    for (size_t index = 0; index < documents_.size(); ++index) {
+        (*inv_word_counts)[index] = 1.0 / documents_.GetWordCount(index);
+    }
+    std::for_each(std::execution::par, term_postings_.begin(), term_postings_.end(), [&inv_word_counts](PostingList& postings) {
+        postings.Compress(inv_word_counts);
+    });
+    document_terms_.Compress(inv_word_counts);
 }
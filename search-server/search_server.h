@@ -1,16 +1,34 @@
 #pragma once
-#include "concurrent_map.h"
+#include "document_attributes.h"
+#include "document_id_map.h"
+#include "forward_index.h"
+#include "inverse_document_freqs.h"
+#include "latency_metrics.h"
+#include "posting_list.h"
+#include "query_arena.h"
+#include "ranking.h"
+#include "result_cache.h"
+#include "score_accumulator.h"
+#include "search_limits.h"
+#include "search_thread_pool.h"
+#include "snapshot.h"
+#include "term_dictionary.h"
+#include "top_documents.h"
 #include <tuple>
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <memory>
+#include <numeric>
 #include <random>
 #include <future>
 #include <set>
 #include <stdexcept>
 #include <execution>
 #include <string>
+#include <thread>
 #include <vector>
 #include "read_input_functions.h"
 #include "string_processing.h"
@@ -29,85 +47,337 @@ public:
     void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>&
     ratings);
 
-     template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate) const;
+    // Bulk ingestion: documents are tokenized concurrently, then every affected posting list is extended once.
+    // Nothing is added if any id or word is invalid
+    void AddDocuments(const std::vector<RawDocument>& documents);
+    void AddDocuments(const std::execution::sequenced_policy&, const std::vector<RawDocument>& documents);
+    void AddDocuments(const std::execution::parallel_policy&, const std::vector<RawDocument>& documents);
+
+    // Adds the documents of other, except skipped_ids, straight from its index without tokenizing them again.
+    // Both servers must have the same stop words. Nothing is added if any id is already present
+    void AddDocumentsFrom(const SearchServer& other, const std::set<int>& skipped_ids = {});
+
+    static constexpr size_t MAX_RESULT_DOCUMENT_COUNT = 5;
+
     template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
     template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
     
-    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status) const;
-    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentStatus status) const;
-    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query,  DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentStatus status, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query,  DocumentStatus status, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // The filter is turned into a bitmap of the documents it accepts before scoring, from the status bitmaps
+    // and the rating array, so a posting costs a bit test rather than a predicate call. Cached like searches by status
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, const DocumentFilter& filter, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, const DocumentFilter& filter, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, const DocumentFilter& filter, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
     
     std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
     std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query) const;
     std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query) const;
 
+    // Like the predicate overloads, but the results are kept in the result cache under cache_key
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, ResultCacheKey cache_key, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentPredicate document_predicate, ResultCacheKey cache_key, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentPredicate document_predicate, ResultCacheKey cache_key, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Ranks by a ranking policy such as Bm25Ranking instead of TF-IDF (TfIdfRanking).
+    // The policy is a template argument, its scoring is compiled into the posting loops.
+    // A DocumentFilter as the predicate is evaluated like in the overloads above
+    template <typename DocumentPredicate, typename Ranking, std::enable_if_t<IsRankingPolicy<Ranking>::value, int> = 0>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, const Ranking& ranking, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename DocumentPredicate, typename Ranking, std::enable_if_t<IsRankingPolicy<Ranking>::value, int> = 0>
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentPredicate document_predicate, const Ranking& ranking, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename DocumentPredicate, typename Ranking, std::enable_if_t<IsRankingPolicy<Ranking>::value, int> = 0>
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentPredicate document_predicate, const Ranking& ranking, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Searches that give up at limits.deadline or once cancelled. The limits are checked between blocks of postings;
+    // a search stopped early returns the best documents scored so far as a partial result. Never cached
+    template <typename DocumentPredicate>
+    SearchResult FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, const SearchLimits& limits, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename DocumentPredicate>
+    SearchResult FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentPredicate document_predicate, const SearchLimits& limits, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename DocumentPredicate>
+    SearchResult FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentPredicate document_predicate, const SearchLimits& limits, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    SearchResult FindTopDocuments(std::string_view raw_query, DocumentStatus status, const SearchLimits& limits, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    SearchResult FindTopDocuments(std::string_view raw_query, const SearchLimits& limits) const;
+
+    // The same, run on a thread of SearchThreadPool. A deadline keeps running while the search waits in its queue.
+    // The server must outlive the future and stay unchanged until it is ready
+    template <typename DocumentPredicate>
+    std::future<SearchResult> FindTopDocumentsAsync(std::string raw_query, DocumentPredicate document_predicate, SearchLimits limits, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::future<SearchResult> FindTopDocumentsAsync(std::string raw_query, DocumentStatus status, SearchLimits limits, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+    std::future<SearchResult> FindTopDocumentsAsync(std::string raw_query, SearchLimits limits) const;
+
+    // Searches the index as a part of a larger corpus: a plus word weighs inv_document_freq(word)
+    // instead of its inverse document frequency in this index
+    template <typename ExecutionPolicy, typename DocumentPredicate, typename InvDocumentFreq>
+    std::vector<Document> FindTopDocumentsInCorpus(const ExecutionPolicy& policy, std::string_view raw_query, DocumentPredicate document_predicate,
+                                                   InvDocumentFreq inv_document_freq, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Answers every query like FindTopDocuments(raw_query). Queries are parsed up front and grouped
+    // into chunks by their most expensive word; each posting list is walked once per chunk
+    // and feeds all queries of the chunk that use it. Chunks run in parallel
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::vector<std::string>& raw_queries) const;
+
     int GetDocumentCount() const;
-    std:: vector<int>::const_iterator begin() const;
-    std:: vector<int>::const_iterator end() const;
-    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+    CorpusStatistics GetCorpusStatistics() const;
+    bool HasDocument(int document_id) const;
+    // Number of documents containing the word
+    int GetDocumentFreq(std::string_view word) const;
+    DocumentIdMap::IdIterator begin() const;
+    DocumentIdMap::IdIterator end() const;
+    std::map<std::string_view, double> GetWordFrequencies(int document_id) const;
+    // Ids of the document's words in ascending order, empty for unknown documents.
+    // Equal word sets give equal vectors, which is all RemoveDuplicates needs
+    std::vector<TermId> GetDocumentTerms(int document_id) const;
     
     void RemoveDocument(int document_id);
     void RemoveDocument(const std::execution::sequenced_policy& , int document_id);
     void RemoveDocument(const std::execution::parallel_policy& , int document_id);
+
+    // Removes all listed documents at once, every affected posting list is rewritten a single time
+    void RemoveDocuments(const std::vector<int>& document_ids);
+    void RemoveDocuments(const std::execution::sequenced_policy&, const std::vector<int>& document_ids);
+    void RemoveDocuments(const std::execution::parallel_policy&, const std::vector<int>& document_ids);
     
+    // Writes stop words, vocabulary, posting lists, the document table and the terms of every document into a versioned, checksummed file
+    void SaveSnapshot(const std::string& path) const;
+    // Memory-maps a file written by SaveSnapshot. Words, posting lists and document terms are used in place, without parsing,
+    // so loading reads the tables only. The postings and terms are checked against their checksum with verify_checksum,
+    // which reads them all; a file damaged there and loaded without it gives undefined results
+    static SearchServer LoadSnapshot(const std::string& path, bool verify_checksum = false);
+
+    // Pins the inverse document frequencies of all known words, so scores stay reproducible while
+    // documents come and go. Words added later get their value on first use and keep it.
+    // Frozen values are stored in snapshots
+    void FreezeInverseDocumentFreqs();
+    void UnfreezeInverseDocumentFreqs();
+
+    // Lets sequential searches of several words skip postings that cannot change the top results.
+    // Results stay the same. Off by default: it pays off only when a few rare words decide the ranking
+    void SetScorePruning(bool enabled);
+
+    // Bytes that separate words of documents and queries, a space by default. Takes effect for documents
+    // added and queries parsed from then on; snapshots do not store it
+    void SetWordSeparators(std::string_view separators);
+
+    // Keeps the results of up to capacity recent searches by status or by a predicate with a ResultCacheKey.
+    // Any change of the documents invalidates them. Off (0) by default, a copy of the server starts with an empty cache
+    void SetResultCacheCapacity(size_t capacity);
+    ResultCacheStats GetResultCacheStats() const;
+
+    // Moves the posting lists and the forward index into a compressed format, several times smaller. Changes stay
+    // block-local: removals recompress the blocks they hit, new postings and documents stay plain until the next call
+    void CompressPostings();
+
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::sequenced_policy&, std::string_view raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy&, std::string_view raw_query, int document_id) const;  
+
+    // Matches the query with every listed document: the query is parsed once and its sorted terms are
+    // intersected with the sorted terms of each document. Throws like MatchDocument for an unknown id
+    DocumentMatches MatchDocuments(std::string_view raw_query, const std::vector<int>& document_ids) const;
+    DocumentMatches MatchDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, const std::vector<int>& document_ids) const;
+    // Documents are matched in parallel
+    DocumentMatches MatchDocuments(const std::execution::parallel_policy&, std::string_view raw_query, const std::vector<int>& document_ids) const;
     
 private:
-    struct DocumentData {
-        std::string data;
-        int rating;
-        DocumentStatus status;
-    };
-    const double TenToTheMinusSixDegree = 1e-6;
-    const int MAX_RESULT_DOCUMENT_COUNT = 5;
-    const int RELEVANCE_COUNT = 1000;
     const std::set<std::string, std::less<>> stop_words_;
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, DocumentData> documents_;
-    std::vector<int> document_ids_;
-    std::map<int, std::map<std::string_view, double>> ids_word_to_document_freqs_;
+    TermDictionary dictionary_;
+    // Indexed by term id
+    std::vector<PostingList> term_postings_;
+    // Indexed by term id, starts a new epoch on every change of the document set
+    InverseDocumentFreqs inverse_document_freqs_;
+    DocumentAttributes documents_;
+    // Forward index: terms of every document sorted by term id, indexed like documents_
+    ForwardIndex document_terms_;
+    // Sum of the word counts of the live documents
+    int64_t total_word_count_ = 0;
+    DocumentIdMap document_to_index_;
+    // Keeps the loaded snapshot mapped while words and postings point into it
+    std::shared_ptr<const MappedFile> snapshot_;
+    bool score_pruning_ = false;
+    WordSeparators separators_;
+    // Filled by const searches
+    mutable QueryResultCache result_cache_;
    
 
     bool IsStopWord(std::string_view word) const;
     static bool IsValidWord(std::string_view word);
 
-    std::vector<std::string_view> SplitIntoWordsNoStop(std::string_view text) const;
+    // Term frequencies of the document sorted by word, the views point into text.
+    // word_count gets the number of words the frequencies are relative to
+    std::vector<std::pair<std::string_view, double>> ComputeWordFrequencies(std::string_view text, int& word_count) const;
 
     static int ComputeAverageRating(const std::vector<int>& ratings);
 
+    TermId InternWord(std::string_view word);
+
+    template <typename ExecutionPolicy>
+    void AddDocumentsImpl(const ExecutionPolicy& policy, const std::vector<RawDocument>& documents);
+    // Returns the id of a word nobody uses anymore to the dictionary
+    void ReleaseTermIfUnused(TermId term);
+
+    // Affected term and the sorted indexes of removed documents in its posting list
+    using WordRemoval = std::pair<TermId, std::vector<int>>;
+    std::vector<WordRemoval> CollectRemovedPostings(const std::vector<int>& document_ids);
+    void FinishRemoval(const std::vector<int>& document_ids, const std::vector<WordRemoval>& removed);
+    // Renumbers the live documents densely once removed ones hold a quarter of the document indexes,
+    // so the per-document arrays and the search scratch stop growing with every document ever added
+    void CompactDocumentsIfSparse();
+    // Fewer removed documents are left in place whatever their share
+    static constexpr size_t COMPACTION_MIN_REMOVED_DOCUMENTS = 1024;
+
+    // Scratch of FindAllDocuments, one per thread. A parallel search uses the scratch of every thread it runs on
+    static ScoreAccumulator& GetScoreAccumulator();
+    // Scratch of FindTopDocumentsBatch, one per thread
+    static BatchScoreAccumulator& GetBatchScoreAccumulator();
+    // Words of the document or query at hand, one per thread
+    static SplitText& GetSplitText();
+    // Memory of the queries parsed on the thread
+    static QueryArena& GetQueryArena();
+
     struct QueryWord {
         std::string_view data;
         bool is_minus;
         bool is_stop;
     };
 
-    QueryWord ParseQueryWord(std::string_view& text) const;
+    // is_valid tells whether the word is free of control characters
+    QueryWord ParseQueryWord(std::string_view& text, bool is_valid) const;
+
+    // Stop state of a search under SearchLimits, shared by the threads of a parallel search
+    class Interruption {
+    public:
+        explicit Interruption(const SearchLimits& limits)
+            : limits_(limits) {
+        }
 
+        // Checks the limits, true from the first time they are exceeded on
+        bool Poll() const {
+            if (!interrupted_.load(std::memory_order_relaxed) && limits_.IsExceeded()) {
+                interrupted_.store(true, std::memory_order_relaxed);
+            }
+            return interrupted_.load(std::memory_order_relaxed);
+        }
+
+        bool IsInterrupted() const {
+            return interrupted_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        const SearchLimits& limits_;
+        mutable std::atomic<bool> interrupted_{false};
+    };
+
+    // Postings scored between two checks of the limits of a search
+    static constexpr size_t INTERRUPTION_POLL_INTERVAL = PostingList::BLOCK_SIZE;
+    // Postings a parallel search gives to each thread at least, a smaller query runs on fewer of them
+    static constexpr size_t PARALLEL_PART_MIN_POSTINGS = 4096;
+
+    // Words are resolved to term ids once, words missing from the index are dropped
     struct Query {
-        std::vector<std::string_view> plus_words;
-        std::vector<std::string_view> minus_words;
+        Query() = default;
+        explicit Query(QueryArena::Lease lease)
+            : plus_terms(lease.GetResource())
+            , minus_terms(lease.GetResource())
+            , plus_term_weights(lease.GetResource())
+            , memory(std::move(lease)) {
+        }
+
+        std::pmr::vector<TermId> plus_terms;
+        std::pmr::vector<TermId> minus_terms;
+        // Weights of the plus terms as the scorer sees them, filled only for a search
+        std::pmr::vector<double> plus_term_weights;
+        // Set for a search under SearchLimits
+        const Interruption* interruption = nullptr;
+        // Scratch of the search goes here too. Declared last: on assignment the vectors take
+        // their new contents before the lease they came with is given up
+        QueryArena::Lease memory;
+
+        // Counts a scanned posting and checks the limits every INTERRUPTION_POLL_INTERVAL of them.
+        // Minus terms are never interrupted, a partial result must not hold an excluded document
+        bool IsInterrupted(size_t& postings_to_poll) const {
+            if (--postings_to_poll != 0) {
+                return false;
+            }
+            postings_to_poll = INTERRUPTION_POLL_INTERVAL;
+            return interruption != nullptr && interruption->Poll();
+        }
+
+        bool WasInterrupted() const {
+            return interruption != nullptr && interruption->IsInterrupted();
+        }
     };
 
-    
-    Query ParseQuery(std::string_view& text) const;
+    // The query lives in the arena of the calling thread unless it is going to leave the thread
+    Query ParseQuery(std::string_view& text, bool leaves_thread = false) const;
     //Query ParseQuery(std::string_view& text, const std::execution::sequenced_policy&) const;
     //Query ParseQuery(std::string_view& text, const std::execution::parallel_policy&) const; 
 
 
-    // Existence required
-    double ComputeWordInverseDocumentFreq(std::string_view& word) const;
+    double ComputeWordInverseDocumentFreq(TermId term) const;
+    // Fills the weights of the plus terms with their inverse document frequencies
+    void WeighQuery(Query& query) const;
+    // Then lets the scorer of a ranking policy turn them into its term weights
+    template <typename Scorer>
+    void WeighQuery(Query& query, const Scorer& scorer) const;
+    // Drops everything computed from the current set of documents
+    void OnDocumentsChanged();
 
-    template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const;
-    template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const std::execution::sequenced_policy&, const Query& query, DocumentPredicate document_predicate) const;
-    template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const std::execution::parallel_policy&, const Query& query, DocumentPredicate document_predicate) const;
+    // Searches through the result cache when it is on. The key tells document_predicate apart from others
+    // and gives the result count, its terms are filled from the query
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocumentsCached(const ExecutionPolicy& policy, std::string_view raw_query, DocumentPredicate document_predicate,
+                                                 QueryResultCache::Key key) const;
+
+    // Scores queries[order[begin]] ... queries[order[end - 1]] together into their places in results
+    void FindBatchChunk(const std::vector<Query>& queries, const std::vector<size_t>& order, size_t begin, size_t end,
+                        std::vector<std::vector<Document>>& results) const;
+
+    // Return the best max_result_count matches, most relevant first. The scorer comes from a ranking policy.
+    // A DocumentFilter is pushed down as a bitmap, any other predicate is called for every posting
+    template <typename ExecutionPolicy, typename DocumentPredicate, typename Scorer = TfIdfRanking::Scorer>
+    std::vector<Document> FindAllDocuments(const ExecutionPolicy& policy, const Query& query, DocumentPredicate document_predicate, size_t max_result_count,
+                                           const Scorer& scorer = Scorer()) const;
+    // The same for document_selector(document_index) telling whether a document may be returned.
+    // The checks of query.interruption are compiled in only if interruptible
+    template <bool interruptible, typename DocumentSelector, typename Scorer>
+    std::vector<Document> ScoreDocuments(const std::execution::sequenced_policy&, const Query& query, DocumentSelector document_selector, size_t max_result_count,
+                                         const Scorer& scorer) const;
+    template <bool interruptible, typename DocumentSelector, typename Scorer>
+    std::vector<Document> ScoreDocuments(const std::execution::parallel_policy&, const Query& query, DocumentSelector document_selector, size_t max_result_count,
+                                         const Scorer& scorer) const;
+
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    SearchResult FindTopDocumentsLimited(const ExecutionPolicy& policy, std::string_view raw_query, DocumentPredicate document_predicate, const SearchLimits& limits,
+                                         size_t max_result_count) const;
+
+    template <typename ExecutionPolicy>
+    DocumentMatches MatchDocumentsImpl(const ExecutionPolicy& policy, std::string_view raw_query, const std::vector<int>& document_ids) const;
+    // Writes the plus terms of query found in the document to matched_terms, returns how many there are.
+    // Returns 0 if a minus term is found
+    size_t MatchTerms(const Query& query, int document_index, TermId* matched_terms) const;
+
+    // With pruning on, queries with this many plus words are evaluated by ScoreDocumentsPruned.
+    // It takes a step per list and document, longer queries are faster scored a list at a time
+    static constexpr size_t PRUNED_QUERY_MIN_TERM_COUNT = 4;
+    static constexpr size_t PRUNED_QUERY_MAX_TERM_COUNT = 16;
+
+    // Block-max MaxScore: the posting lists are walked together, a document at a time. Lists whose bounds add up
+    // to less than the weakest of the best max_result_count documents so far cannot bring in a document on their own
+    // and are only probed for the documents of the others, once the bounds of their blocks, read without
+    // decoding a block, leave the document a chance. Returns exactly what exhaustive scoring does
+    template <bool interruptible, typename DocumentSelector, typename Scorer>
+    std::vector<Document> ScoreDocumentsPruned(const Query& query, DocumentSelector document_selector, size_t max_result_count, const Scorer& scorer) const;
 
 };    
 
@@ -119,110 +389,442 @@ SearchServer::SearchServer(const StringContainer& stop_words) : stop_words_(Make
 }
  
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate) const {
-    return FindTopDocuments(std::execution::seq,raw_query, document_predicate);
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count) const {
+    return FindTopDocuments(std::execution::seq,raw_query, document_predicate, max_result_count);
 }
  
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentPredicate document_predicate) const {
-    const auto query = ParseQuery(raw_query);
-    auto matched_doc = FindAllDocuments(std::execution::seq, query, document_predicate);
-    sort(std::execution::seq,  matched_doc.begin(), matched_doc.end(), 
-         [this](const Document& lhs, const Document& rhs) {
-             if (std::abs(lhs.relevance - rhs.relevance) < TenToTheMinusSixDegree) {
-                 return lhs.rating > rhs.rating;
-         } else {
-                 return lhs.relevance > rhs.relevance;
-         }
-    });
-    if (matched_doc.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_doc.resize(MAX_RESULT_DOCUMENT_COUNT);
-    }
-    return matched_doc;
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count) const {
+    SEARCH_METRICS_TIME(FIND_TOP_DOCUMENTS);
+    auto query = ParseQuery(raw_query);
+    WeighQuery(query);
+    return FindAllDocuments(std::execution::seq, query, document_predicate, max_result_count);
 }
  
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentPredicate document_predicate) const {
-    const auto query = ParseQuery(raw_query);
-    auto matched_doc = FindAllDocuments(std::execution::par, query, document_predicate);
-    sort(std::execution::par, matched_doc.begin(), matched_doc.end(), 
-         [this](const Document& lhs, const Document& rhs) {
-             if (std::abs(lhs.relevance - rhs.relevance) < TenToTheMinusSixDegree) {
-                 return lhs.rating > rhs.rating;
-             } else {
-                 return lhs.relevance > rhs.relevance;
-             }
-         });
-    if (matched_doc.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_doc.resize(MAX_RESULT_DOCUMENT_COUNT);
-    }
-    return matched_doc;
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count) const {
+    SEARCH_METRICS_TIME(FIND_TOP_DOCUMENTS);
+    auto query = ParseQuery(raw_query);
+    WeighQuery(query);
+    return FindAllDocuments(std::execution::par, query, document_predicate, max_result_count);
 }
- 
+
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const {
-    return FindAllDocuments(std::execution::seq, query, document_predicate);
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, ResultCacheKey cache_key, size_t max_result_count) const {
+    return FindTopDocumentsCached(std::execution::seq, raw_query, document_predicate, {{}, {}, false, cache_key.value, 0, 0, max_result_count});
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::sequenced_policy&, const Query& query, DocumentPredicate document_predicate) const {
-    std::map<int, double> document_to_relevance;
-    for (std::string_view word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        const double inv_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id] += term_freq * inv_document_freq;
-                }
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentPredicate document_predicate, ResultCacheKey cache_key, size_t max_result_count) const {
+    return FindTopDocumentsCached(std::execution::seq, raw_query, document_predicate, {{}, {}, false, cache_key.value, 0, 0, max_result_count});
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentPredicate document_predicate, ResultCacheKey cache_key, size_t max_result_count) const {
+    return FindTopDocumentsCached(std::execution::par, raw_query, document_predicate, {{}, {}, false, cache_key.value, 0, 0, max_result_count});
+}
+
+template <typename DocumentPredicate, typename Ranking, std::enable_if_t<IsRankingPolicy<Ranking>::value, int>>
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, const Ranking& ranking, size_t max_result_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, document_predicate, ranking, max_result_count);
+}
+
+template <typename DocumentPredicate, typename Ranking, std::enable_if_t<IsRankingPolicy<Ranking>::value, int>>
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentPredicate document_predicate, const Ranking& ranking,
+                                                     size_t max_result_count) const {
+    SEARCH_METRICS_TIME(FIND_TOP_DOCUMENTS);
+    auto query = ParseQuery(raw_query);
+    const auto scorer = ranking.Prepare(GetCorpusStatistics());
+    WeighQuery(query, scorer);
+    return FindAllDocuments(std::execution::seq, query, document_predicate, max_result_count, scorer);
+}
+
+template <typename DocumentPredicate, typename Ranking, std::enable_if_t<IsRankingPolicy<Ranking>::value, int>>
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentPredicate document_predicate, const Ranking& ranking,
+                                                     size_t max_result_count) const {
+    SEARCH_METRICS_TIME(FIND_TOP_DOCUMENTS);
+    auto query = ParseQuery(raw_query);
+    const auto scorer = ranking.Prepare(GetCorpusStatistics());
+    WeighQuery(query, scorer);
+    return FindAllDocuments(std::execution::par, query, document_predicate, max_result_count, scorer);
+}
+
+template <typename DocumentPredicate>
+SearchResult SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, const SearchLimits& limits, size_t max_result_count) const {
+    return FindTopDocumentsLimited(std::execution::seq, raw_query, document_predicate, limits, max_result_count);
+}
+
+template <typename DocumentPredicate>
+SearchResult SearchServer::FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentPredicate document_predicate, const SearchLimits& limits,
+                                            size_t max_result_count) const {
+    return FindTopDocumentsLimited(std::execution::seq, raw_query, document_predicate, limits, max_result_count);
+}
+
+template <typename DocumentPredicate>
+SearchResult SearchServer::FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentPredicate document_predicate, const SearchLimits& limits,
+                                            size_t max_result_count) const {
+    return FindTopDocumentsLimited(std::execution::par, raw_query, document_predicate, limits, max_result_count);
+}
+
+template <typename DocumentPredicate>
+std::future<SearchResult> SearchServer::FindTopDocumentsAsync(std::string raw_query, DocumentPredicate document_predicate, SearchLimits limits, size_t max_result_count) const {
+    return SearchThreadPool::Get().Submit([this, raw_query = std::move(raw_query), document_predicate, limits = std::move(limits), max_result_count] {
+        return FindTopDocumentsLimited(std::execution::seq, raw_query, document_predicate, limits, max_result_count);
+    });
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+SearchResult SearchServer::FindTopDocumentsLimited(const ExecutionPolicy& policy, std::string_view raw_query, DocumentPredicate document_predicate, const SearchLimits& limits,
+                                                   size_t max_result_count) const {
+    SEARCH_METRICS_TIME(FIND_TOP_DOCUMENTS);
+    const Interruption interruption(limits);
+    auto query = ParseQuery(raw_query);
+    query.interruption = &interruption;
+    WeighQuery(query);
+    SearchResult result;
+    result.documents = FindAllDocuments(policy, query, document_predicate, max_result_count);
+    result.is_partial = interruption.IsInterrupted();
+    return result;
+}
+
+template <typename Scorer>
+void SearchServer::WeighQuery(Query& query, const Scorer& scorer) const {
+    WeighQuery(query);
+    for (double& term_weight : query.plus_term_weights) {
+        term_weight = scorer.WeighTerm(term_weight);
+    }
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocumentsCached(const ExecutionPolicy& policy, std::string_view raw_query, DocumentPredicate document_predicate,
+                                                           QueryResultCache::Key key) const {
+    SEARCH_METRICS_TIME(FIND_TOP_DOCUMENTS);
+    auto query = ParseQuery(raw_query);
+    if (!result_cache_.IsEnabled()) {
+        WeighQuery(query);
+        return FindAllDocuments(policy, query, document_predicate, key.max_result_count);
+    }
+    // Parsed terms are sorted and unique, so the key ignores word order and repeats
+    key.plus_terms.assign(query.plus_terms.begin(), query.plus_terms.end());
+    key.minus_terms.assign(query.minus_terms.begin(), query.minus_terms.end());
+    if (auto documents = result_cache_.Find(key)) {
+        return std::move(*documents);
+    }
+    WeighQuery(query);
+    auto documents = FindAllDocuments(policy, query, document_predicate, key.max_result_count);
+    result_cache_.Insert(std::move(key), documents);
+    return documents;
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate, typename InvDocumentFreq>
+std::vector<Document> SearchServer::FindTopDocumentsInCorpus(const ExecutionPolicy& policy, std::string_view raw_query, DocumentPredicate document_predicate,
+                                                             InvDocumentFreq inv_document_freq, size_t max_result_count) const {
+    auto query = ParseQuery(raw_query);
+    query.plus_term_weights.reserve(query.plus_terms.size());
+    for (const TermId term : query.plus_terms) {
+        query.plus_term_weights.push_back(inv_document_freq(dictionary_.GetText(term)));
+    }
+    return FindAllDocuments(policy, query, document_predicate, max_result_count);
+}
+ 
+template <typename ExecutionPolicy, typename DocumentPredicate, typename Scorer>
+std::vector<Document> SearchServer::FindAllDocuments(const ExecutionPolicy& policy, const Query& query, DocumentPredicate document_predicate, size_t max_result_count,
+                                                     const Scorer& scorer) const {
+    // Searches without limits pay nothing for them
+    const auto score = [&](auto document_selector) {
+        if (query.interruption != nullptr) {
+            return ScoreDocuments<true>(policy, query, document_selector, max_result_count, scorer);
+        }
+        return ScoreDocuments<false>(policy, query, document_selector, max_result_count, scorer);
+    };
+    if constexpr (std::is_same_v<DocumentPredicate, DocumentFilter>) {
+        if ((document_predicate.statuses & DocumentFilter::ALL_STATUSES) == DocumentFilter::ALL_STATUSES && !document_predicate.HasRatingRange()) {
+            return score([](int) { return true; });
+        }
+        std::pmr::vector<uint64_t> selected(query.memory.GetResource());
+        const uint64_t* bits = nullptr;
+        const uint32_t statuses = document_predicate.statuses;
+        if (!document_predicate.HasRatingRange() && statuses != 0 && (statuses & (statuses - 1)) == 0) {
+            // A single status has its bitmap ready
+            int status = 0;
+            while (!(statuses >> status & 1)) {
+                ++status;
             }
+            bits = documents_.GetStatusBits(static_cast<DocumentStatus>(status));
+        } else {
+            documents_.Select(document_predicate, selected);
+            bits = selected.data();
+        }
+        return score([bits](int document_index) {
+            return IsDocumentSelected(bits, document_index);
+        });
+    } else {
+        return score([this, &document_predicate](int document_index) {
+            return document_predicate(documents_.GetId(document_index), documents_.GetStatus(document_index), documents_.GetRating(document_index));
+        });
+    }
+}
+
+template <bool interruptible, typename DocumentSelector, typename Scorer>
+std::vector<Document> SearchServer::ScoreDocuments(const std::execution::sequenced_policy&, const Query& query, DocumentSelector document_selector, size_t max_result_count,
+                                                   const Scorer& scorer) const {
+    if (score_pruning_ && query.plus_terms.size() >= PRUNED_QUERY_MIN_TERM_COUNT && query.plus_terms.size() <= PRUNED_QUERY_MAX_TERM_COUNT) {
+        return ScoreDocumentsPruned<interruptible>(query, document_selector, max_result_count, scorer);
+    }
+    SEARCH_METRICS_START(scoring_timer, SCORE_POSTINGS);
+    ScoreAccumulator& document_to_relevance = GetScoreAccumulator();
+    document_to_relevance.Reset(documents_.size());
+    for (const TermId term : query.minus_terms) {
+        SEARCH_METRICS_COUNT(POSTINGS_SCANNED, term_postings_[term].size());
+        for (const auto [document_index, _] : term_postings_[term]) {
+            document_to_relevance.Exclude(document_index);
         }
-        for (const auto word : query.minus_words) {
-            if (word_to_document_freqs_.count(word) == 0) {
+    }
+    size_t postings_to_poll = INTERRUPTION_POLL_INTERVAL;
+    for (size_t plus_index = 0; plus_index < query.plus_terms.size() && !query.WasInterrupted(); ++plus_index) {
+        const double term_weight = query.plus_term_weights[plus_index];
+        SEARCH_METRICS_COUNT(POSTINGS_SCANNED, term_postings_[query.plus_terms[plus_index]].size());
+        for (const auto [document_index, term_freq] : term_postings_[query.plus_terms[plus_index]]) {
+            if (interruptible && query.IsInterrupted(postings_to_poll)) {
+                break;
+            }
+            if (document_to_relevance.IsExcluded(document_index)) {
                 continue;
             }
-            for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-                document_to_relevance.erase(document_id);
+            if (document_selector(document_index)) {
+                document_to_relevance.Add(document_index, scorer(term_weight, term_freq, documents_.GetWordCount(document_index)));
             }
         }
-        std::vector<Document> matched_doc;
-        for (const auto [document_id, relevance] : document_to_relevance) {
-            matched_doc.push_back({document_id, relevance, documents_.at(document_id).rating});
-        }
-        return matched_doc;
     }
+    SEARCH_METRICS_STOP(scoring_timer);
+    SEARCH_METRICS_TIME(SELECT_TOP_DOCUMENTS);
+    SEARCH_METRICS_COUNT(DOCUMENTS_SCORED, document_to_relevance.GetTouched().size());
+    TopDocuments top_documents(max_result_count);
+    for (const int document_index : document_to_relevance.GetTouched()) {
+        top_documents.Push({documents_.GetId(document_index), document_to_relevance.GetScore(document_index), documents_.GetRating(document_index)});
+    }
+    return top_documents.Extract();
+}
  
-template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::parallel_policy&, const Query& query, DocumentPredicate document_predicate) const {
-    ConcurrentMap<int, double> document_to_relevance(RELEVANCE_COUNT);
-    const auto plus = [this, &document_predicate, &document_to_relevance] (std::string_view word) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            return;
-        }
-        const double inv_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto& [document_id, term_freq] : word_to_document_freqs_.at(word)) { 
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id].ref_to_value += term_freq * inv_document_freq;
+template <bool interruptible, typename DocumentSelector, typename Scorer>
+std::vector<Document> SearchServer::ScoreDocuments(const std::execution::parallel_policy&, const Query& query, DocumentSelector document_selector, size_t max_result_count,
+                                                   const Scorer& scorer) const {
+    SEARCH_METRICS_START(scoring_timer, SCORE_POSTINGS);
+    size_t expected_hit_count = 0;
+    for (const TermId term : query.plus_terms) {
+        expected_hit_count += term_postings_[term].size();
+    }
+    SEARCH_METRICS_COUNT(POSTINGS_SCANNED, expected_hit_count);
+#ifdef SEARCH_SERVER_METRICS
+    for (const TermId term : query.minus_terms) {
+        SEARCH_METRICS_COUNT(POSTINGS_SCANNED, term_postings_[term].size());
+    }
+#endif
+    // Every part scores its own range of document indexes in the dense scratch of the thread it runs on,
+    // so no two threads ever touch the same document and no posting takes a lock
+    const size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    const size_t part_count = std::min(thread_count, expected_hit_count / PARALLEL_PART_MIN_POSTINGS + 1);
+    const size_t document_count = documents_.size();
+    std::vector<TopDocuments> parts(part_count, TopDocuments(max_result_count));
+    std::vector<size_t> part_indexes(part_count);
+    std::iota(part_indexes.begin(), part_indexes.end(), 0);
+    for_each(std::execution::par, part_indexes.begin(), part_indexes.end(), [&](size_t part) {
+        const int first_document = static_cast<int>(document_count * part / part_count);
+        const int last_document = static_cast<int>(document_count * (part + 1) / part_count);
+        ScoreAccumulator& document_to_relevance = GetScoreAccumulator();
+        document_to_relevance.Reset(document_count);
+        for (const TermId term : query.minus_terms) {
+            auto posting = term_postings_[term].begin();
+            for (posting.SkipTo(first_document); posting != term_postings_[term].end() && posting->document_index < last_document; ++posting) {
+                document_to_relevance.Exclude(posting->document_index);
             }
         }
-    };
-    for_each(std::execution::par, query.plus_words.begin(), query.plus_words.end(), plus);
-    const auto minus = [&](std::string_view word) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            return;
+        size_t postings_to_poll = INTERRUPTION_POLL_INTERVAL;
+        for (size_t plus_index = 0; plus_index < query.plus_terms.size() && !query.WasInterrupted(); ++plus_index) {
+            const double term_weight = query.plus_term_weights[plus_index];
+            const PostingList& postings = term_postings_[query.plus_terms[plus_index]];
+            auto posting = postings.begin();
+            for (posting.SkipTo(first_document); posting != postings.end() && posting->document_index < last_document; ++posting) {
+                if (interruptible && query.IsInterrupted(postings_to_poll)) {
+                    break;
+                }
+                const int document_index = posting->document_index;
+                if (document_to_relevance.IsExcluded(document_index)) {
+                    continue;
+                }
+                if (document_selector(document_index)) {
+                    document_to_relevance.Add(document_index, scorer(term_weight, posting->term_freq, documents_.GetWordCount(document_index)));
+                }
+            }
+        }
+        SEARCH_METRICS_COUNT(DOCUMENTS_SCORED, document_to_relevance.GetTouched().size());
+        for (const int document_index : document_to_relevance.GetTouched()) {
+            parts[part].Push({documents_.GetId(document_index), document_to_relevance.GetScore(document_index), documents_.GetRating(document_index)});
         }
-        for (const auto& [document_id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(document_id);
+    });
+    SEARCH_METRICS_STOP(scoring_timer);
+    SEARCH_METRICS_TIME(SELECT_TOP_DOCUMENTS);
+    TopDocuments top_documents(max_result_count);
+    for (const auto& part : parts) {
+        top_documents.Merge(part);
+    }
+    return top_documents.Extract();
+}
+
+template <bool interruptible, typename DocumentSelector, typename Scorer>
+std::vector<Document> SearchServer::ScoreDocumentsPruned(const Query& query, DocumentSelector document_selector, size_t max_result_count, const Scorer& scorer) const {
+    if (max_result_count == 0) {
+        return {};
+    }
+    SEARCH_METRICS_START(scoring_timer, SCORE_POSTINGS);
+    ScoreAccumulator& document_to_relevance = GetScoreAccumulator();
+    document_to_relevance.Reset(documents_.size());
+    for (const TermId term : query.minus_terms) {
+        SEARCH_METRICS_COUNT(POSTINGS_SCANNED, term_postings_[term].size());
+        for (const auto [document_index, _] : term_postings_[term]) {
+            document_to_relevance.Exclude(document_index);
+        }
+    }
+
+    struct Cursor {
+        PostingList::const_iterator position;
+        // Document of the current posting, int max past the end
+        int document_index;
+        double term_weight;
+        double max_score;
+        size_t plus_index;
+        // The block last peeked at and the score bound of its postings
+        const PostingList::Block* block = nullptr;
+        double block_bound = 0.0;
+
+        void Update() {
+            document_index = position != PostingList::Sentinel{} ? position->document_index : std::numeric_limits<int>::max();
+        }
+        void Next() {
+            ++position;
+            Update();
+        }
+        void SkipTo(int target) {
+            position.SkipTo(target);
+            Update();
+        }
+    };
+    const size_t term_count = query.plus_terms.size();
+    std::pmr::memory_resource* const scratch = query.memory.GetResource();
+    std::pmr::vector<double> max_scores(term_count, scratch);
+    std::pmr::vector<size_t> plus_indexes(term_count, scratch);
+    for (size_t plus_index = 0; plus_index < term_count; ++plus_index) {
+        max_scores[plus_index] = scorer.MaxScore(query.plus_term_weights[plus_index], term_postings_[query.plus_terms[plus_index]].GetMaxTermFreq());
+        plus_indexes[plus_index] = plus_index;
+    }
+    // Low scoring terms first: the long lists of frequent words are the first to be only probed
+    std::stable_sort(plus_indexes.begin(), plus_indexes.end(), [&max_scores](size_t lhs, size_t rhs) {
+        return max_scores[lhs] < max_scores[rhs];
+    });
+    std::pmr::vector<Cursor> cursors(scratch);
+    cursors.reserve(term_count);
+    for (const size_t plus_index : plus_indexes) {
+        cursors.push_back({term_postings_[query.plus_terms[plus_index]].begin(), 0, query.plus_term_weights[plus_index], max_scores[plus_index], plus_index});
+        cursors.back().Update();
+    }
+    // bound_sums[i] bounds what cursors 0 ... i - 1 add to a document together
+    std::pmr::vector<double> bound_sums(term_count + 1, 0.0, scratch);
+    for (size_t i = 0; i < term_count; ++i) {
+        bound_sums[i + 1] = bound_sums[i] + cursors[i].max_score;
+    }
+
+    // Scores only grow, so a document more than RELEVANCE_EPSILON below the weakest of the best max_result_count
+    // scores can never be returned. The second epsilon covers the rounding of bound sums
+    std::pmr::vector<double> best_scores(scratch);
+    double threshold = -std::numeric_limits<double>::infinity();
+    // Cursors before it are only probed, the others bring in the candidates
+    size_t first_essential = 0;
+    const auto find_next_document = [&]() {
+        int next_document = std::numeric_limits<int>::max();
+        for (size_t i = first_essential; i < term_count; ++i) {
+            next_document = std::min(next_document, cursors[i].document_index);
         }
+        return next_document;
     };
-    for_each(std::execution::par, query.minus_words.begin(), query.minus_words.end(), minus);
-    const auto& document_to_relevance_ = document_to_relevance.BuildOrdinaryMap();
-    std::vector<Document> matched_doc;
-    for (const auto& [document_id, relevance] : document_to_relevance_) {
-        matched_doc.push_back({document_id, relevance, documents_.at(document_id).rating });
+    // Indexed by plus index, so a relevance is summed in the order exhaustive scoring adds it up
+    std::pmr::vector<double> term_scores(term_count, 0.0, scratch);
+    TopDocuments top_documents(max_result_count);
+    size_t postings_to_poll = INTERRUPTION_POLL_INTERVAL;
+    for (int document_index = find_next_document(); document_index != std::numeric_limits<int>::max();) {
+        if (interruptible && query.IsInterrupted(postings_to_poll)) {
+            break;
+        }
+        const bool is_selected = !document_to_relevance.IsExcluded(document_index) && document_selector(document_index);
+        const int word_count = is_selected ? documents_.GetWordCount(document_index) : 0;
+        double score = 0.0;
+        int next_document = std::numeric_limits<int>::max();
+        for (size_t i = first_essential; i < term_count; ++i) {
+            Cursor& cursor = cursors[i];
+            if (cursor.document_index == document_index) {
+                if (is_selected) {
+                    term_scores[cursor.plus_index] = scorer(cursor.term_weight, cursor.position->term_freq, word_count);
+                    score += term_scores[cursor.plus_index];
+                }
+                cursor.Next();
+            }
+            next_document = std::min(next_document, cursor.document_index);
+        }
+        // The probed terms, highest bound first. Their block bounds are read off the block table and cut
+        // the bound before any block is decoded, a document that cannot make it is dropped unprobed
+        bool is_candidate = is_selected && score + bound_sums[first_essential] >= threshold;
+        if (is_candidate && first_essential > 0) {
+            double remaining_bound = bound_sums[first_essential];
+            for (size_t i = first_essential; i > 0 && is_candidate; --i) {
+                Cursor& cursor = cursors[i - 1];
+                const PostingList::Block* block = cursor.position.PeekBlock(document_index);
+                if (block != cursor.block) {
+                    cursor.block = block;
+                    cursor.block_bound = block ? scorer.MaxScore(cursor.term_weight, block->max_term_freq) : 0.0;
+                }
+                remaining_bound -= cursor.max_score - cursor.block_bound;
+                is_candidate = score + remaining_bound >= threshold;
+            }
+            for (size_t i = first_essential; i > 0 && is_candidate; --i) {
+                Cursor& cursor = cursors[i - 1];
+                remaining_bound -= cursor.block_bound;
+                cursor.SkipTo(document_index);
+                if (cursor.document_index == document_index) {
+                    term_scores[cursor.plus_index] = scorer(cursor.term_weight, cursor.position->term_freq, word_count);
+                    score += term_scores[cursor.plus_index];
+                }
+                is_candidate = score + remaining_bound >= threshold;
+            }
+        }
+        if (is_candidate) {
+            double relevance = 0.0;
+            for (const double term_score : term_scores) {
+                relevance += term_score;
+            }
+            top_documents.Push({documents_.GetId(document_index), relevance, documents_.GetRating(document_index)});
+            if (best_scores.size() < max_result_count || relevance > best_scores.front()) {
+                if (best_scores.size() == max_result_count) {
+                    std::pop_heap(best_scores.begin(), best_scores.end(), std::greater<>());
+                    best_scores.pop_back();
+                }
+                best_scores.push_back(relevance);
+                std::push_heap(best_scores.begin(), best_scores.end(), std::greater<>());
+                if (best_scores.size() == max_result_count) {
+                    threshold = best_scores.front() - 2 * RELEVANCE_EPSILON;
+                    const size_t previous_first_essential = first_essential;
+                    while (first_essential < term_count && bound_sums[first_essential + 1] < threshold) {
+                        ++first_essential;
+                    }
+                    if (first_essential != previous_first_essential) {
+                        next_document = find_next_document();
+                    }
+                }
+            }
+        }
+        if (is_selected) {
+            std::fill(term_scores.begin(), term_scores.end(), 0.0);
+        }
+        document_index = next_document;
     }
-    return matched_doc;
+    SEARCH_METRICS_STOP(scoring_timer);
+    return top_documents.Extract();
 }
@@ -0,0 +1,44 @@
+#include "search_thread_pool.h"
+#include <algorithm>
+
+SearchThreadPool& SearchThreadPool::Get() {
+    // Searches may still be queued during static destruction, so the pool is never destroyed
+    static SearchThreadPool* pool = new SearchThreadPool(std::max(1u, std::thread::hardware_concurrency()));
+    return *pool;
+}
+
+SearchThreadPool::SearchThreadPool(size_t thread_count) {
+    threads_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads_.emplace_back(&SearchThreadPool::WorkerLoop, this);
+    }
+}
+
+SearchThreadPool::~SearchThreadPool() {
+    {
+        std::lock_guard guard(mutex_);
+        stopped_ = true;
+    }
+    task_added_.notify_all();
+    for (std::thread& thread : threads_) {
+        thread.join();
+    }
+}
+
+void SearchThreadPool::WorkerLoop() {
+    std::unique_lock lock(mutex_);
+    while (true) {
+        task_added_.wait(lock, [this] {
+            return stopped_ || !tasks_.empty();
+        });
+        if (tasks_.empty()) {
+            return;
+        }
+        std::function<void()> task = std::move(tasks_.front());
+        tasks_.pop_front();
+        lock.unlock();
+        // A packaged task keeps exceptions for its future, nothing escapes here
+        task();
+        lock.lock();
+    }
+}
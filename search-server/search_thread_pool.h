@@ -0,0 +1,56 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A fixed set of threads for searches that run in the background. The threads live as long as the
+// process, so their per-thread scratch (score accumulators, query arenas) is allocated once and reused
+// by every search they run, instead of on a fresh thread per search
+class SearchThreadPool {
+public:
+    // Shared by all servers, one thread per core
+    static SearchThreadPool& Get();
+
+    explicit SearchThreadPool(size_t thread_count);
+    SearchThreadPool(const SearchThreadPool&) = delete;
+    SearchThreadPool& operator=(const SearchThreadPool&) = delete;
+    // Lets the queued tasks finish, then joins the threads
+    ~SearchThreadPool();
+
+    // Queues function() for the next free thread, its result or exception goes to the future
+    template <typename Function>
+    std::future<std::invoke_result_t<Function>> Submit(Function function);
+
+private:
+    std::mutex mutex_;
+    std::condition_variable task_added_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopped_ = false;
+    // Started last, when everything they use is in place
+    std::vector<std::thread> threads_;
+
+    void WorkerLoop();
+};
+
+template <typename Function>
+std::future<std::invoke_result_t<Function>> SearchThreadPool::Submit(Function function) {
+    // std::function needs a copyable target, the task itself is move-only
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<Function>()>>(std::move(function));
+    auto result = task->get_future();
+    {
+        std::lock_guard guard(mutex_);
+        tasks_.emplace_back([task] {
+            (*task)();
+        });
+    }
+    task_added_.notify_one();
+    return result;
+}
@@ -0,0 +1,283 @@
+#include "segmented_search_server.h"
+#include <algorithm>
+#include <cmath>
+
+SegmentedSearchServer::SegmentedSearchServer(const std::string& stop_words_text, size_t write_segment_size)
+    : SegmentedSearchServer(SplitIntoWords(stop_words_text), write_segment_size) {
+}
+
+SegmentedSearchServer::~SegmentedSearchServer() {
+    {
+        std::lock_guard guard(write_mutex_);
+        stopped_ = true;
+    }
+    background_wanted_.notify_all();
+    background_thread_.join();
+}
+
+void SegmentedSearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings) {
+    std::lock_guard guard(write_mutex_);
+    if ((document_id < 0) || (document_ids_.count(document_id) > 0)) {
+        throw std::invalid_argument("Invalid id"s);
+    }
+    write_segment_->AddDocument(document_id, document, status, ratings);
+    document_ids_.insert(document_id);
+    MarkWriteSegmentChanged();
+    SealWriteSegmentIfFull();
+}
+
+void SegmentedSearchServer::AddDocuments(const std::vector<RawDocument>& documents) {
+    std::lock_guard guard(write_mutex_);
+    std::set<int> batch_ids;
+    for (const RawDocument& document : documents) {
+        if ((document.id < 0) || (document_ids_.count(document.id) > 0) || !batch_ids.insert(document.id).second) {
+            throw std::invalid_argument("Invalid id"s);
+        }
+    }
+    if (documents.size() >= write_segment_size_) {
+        auto segment = std::make_shared<SearchServer>(empty_segment_);
+        segment->AddDocuments(std::execution::par, documents);
+        segment->CompressPostings();
+        auto next = std::make_shared<Generation>(generation_.Get());
+        next->segments.insert(next->segments.end() - 1, {std::move(segment), nullptr});
+        PublishGeneration(std::move(next));
+        background_wanted_.notify_one();
+    } else {
+        write_segment_->AddDocuments(documents);
+        MarkWriteSegmentChanged();
+        SealWriteSegmentIfFull();
+    }
+    document_ids_.merge(batch_ids);
+}
+
+void SegmentedSearchServer::RemoveDocument(int document_id) {
+    std::lock_guard guard(write_mutex_);
+    if (document_ids_.erase(document_id) == 0) {
+        return;
+    }
+    if (write_segment_->HasDocument(document_id)) {
+        write_segment_->RemoveDocument(document_id);
+        MarkWriteSegmentChanged();
+        return;
+    }
+    auto next = std::make_shared<Generation>(generation_.Get());
+    // A removed id may be added again, only the segment where it is live gets the tombstone
+    for (auto segment = next->segments.begin(); segment + 1 != next->segments.end(); ++segment) {
+        if (segment->index->HasDocument(document_id) && !(segment->tombstones && segment->tombstones->document_ids.count(document_id) > 0)) {
+            segment->tombstones = AddTombstones(*segment, {document_id});
+            break;
+        }
+    }
+    PublishGeneration(std::move(next));
+    background_wanted_.notify_one();
+}
+
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status, size_t max_result_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, status, max_result_count);
+}
+
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentStatus status, size_t max_result_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, DocumentFilter::ByStatus(status), max_result_count);
+}
+
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentStatus status, size_t max_result_count) const {
+    return FindTopDocuments(std::execution::par, raw_query, DocumentFilter::ByStatus(status), max_result_count);
+}
+
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(std::string_view raw_query) const {
+    return FindTopDocuments(std::execution::seq, raw_query, DocumentStatus::ACTUAL);
+}
+
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query) const {
+    return FindTopDocuments(std::execution::seq, raw_query, DocumentStatus::ACTUAL);
+}
+
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query) const {
+    return FindTopDocuments(std::execution::par, raw_query, DocumentStatus::ACTUAL);
+}
+
+void SegmentedSearchServer::Refresh() {
+    std::lock_guard guard(write_mutex_);
+    RefreshLocked();
+}
+
+int SegmentedSearchServer::GetDocumentCount() const {
+    return generation_.Pin()->document_count;
+}
+
+size_t SegmentedSearchServer::GetSegmentCount() const {
+    return generation_.Pin()->segments.size();
+}
+
+void SegmentedSearchServer::WaitForMerges() {
+    std::unique_lock lock(write_mutex_);
+    merges_done_.wait(lock, [this] {
+        return !merging_ && PlanMerge().empty();
+    });
+}
+
+double SegmentedSearchServer::Generation::ComputeWordInverseDocumentFreq(std::string_view word) const {
+    int document_freq = 0;
+    for (const Segment& segment : segments) {
+        document_freq += segment.index->GetDocumentFreq(word);
+        if (segment.tombstones) {
+            const auto removed = segment.tombstones->document_freqs.find(word);
+            if (removed != segment.tombstones->document_freqs.end()) {
+                document_freq -= removed->second;
+            }
+        }
+    }
+    // Only removed documents contain the word, none of them can be found
+    if (document_freq == 0) {
+        return 0.0;
+    }
+    return std::log(document_count * 1.0 / document_freq);
+}
+
+void SegmentedSearchServer::PublishGeneration(std::shared_ptr<Generation> next) {
+    next->document_count = 0;
+    for (const Segment& segment : next->segments) {
+        const size_t removed_count = segment.tombstones ? segment.tombstones->document_ids.size() : 0;
+        next->document_count += segment.index->GetDocumentCount() - static_cast<int>(removed_count);
+    }
+    generation_.Publish(std::move(next));
+}
+
+void SegmentedSearchServer::RefreshLocked() {
+    if (!write_segment_changed_) {
+        return;
+    }
+    auto next = std::make_shared<Generation>(generation_.Get());
+    next->segments.back() = {std::make_shared<const SearchServer>(*write_segment_), nullptr};
+    PublishGeneration(std::move(next));
+    write_segment_changed_ = false;
+}
+
+void SegmentedSearchServer::MarkWriteSegmentChanged() {
+    if (!write_segment_changed_) {
+        write_segment_changed_ = true;
+        background_wanted_.notify_one();
+    }
+}
+
+void SegmentedSearchServer::SealWriteSegmentIfFull() {
+    if (write_segment_->GetDocumentCount() < static_cast<int>(write_segment_size_)) {
+        return;
+    }
+    write_segment_->CompressPostings();
+    auto next = std::make_shared<Generation>(generation_.Get());
+    next->segments.back() = {std::move(write_segment_), nullptr};
+    write_segment_ = std::make_shared<SearchServer>(empty_segment_);
+    next->segments.push_back({std::make_shared<const SearchServer>(empty_segment_), nullptr});
+    PublishGeneration(std::move(next));
+    write_segment_changed_ = false;
+    background_wanted_.notify_one();
+}
+
+std::shared_ptr<const SegmentedSearchServer::Tombstones> SegmentedSearchServer::AddTombstones(const Segment& segment, const std::vector<int>& document_ids) {
+    auto tombstones = segment.tombstones ? std::make_shared<Tombstones>(*segment.tombstones) : std::make_shared<Tombstones>();
+    for (const int document_id : document_ids) {
+        if (!tombstones->document_ids.insert(document_id).second) {
+            continue;
+        }
+        for (const auto& [word, _] : segment.index->GetWordFrequencies(document_id)) {
+            ++tombstones->document_freqs[word];
+        }
+    }
+    return tombstones;
+}
+
+void SegmentedSearchServer::BackgroundLoop() {
+    std::unique_lock lock(write_mutex_);
+    while (!stopped_) {
+        if (write_segment_changed_) {
+            // Lets changes pile up, then publishes them with a single copy
+            background_wanted_.wait_for(lock, REFRESH_INTERVAL, [this] {
+                return stopped_;
+            });
+            RefreshLocked();
+            continue;
+        }
+        const std::vector<Segment> segments = PlanMerge();
+        if (segments.empty()) {
+            merges_done_.notify_all();
+            background_wanted_.wait(lock);
+            continue;
+        }
+        // Only this thread replaces sealed segments, they stay in place while it works unlocked
+        merging_ = true;
+        lock.unlock();
+        auto merged = std::make_shared<const SearchServer>(MergeSegments(segments));
+        lock.lock();
+        InstallMerge(segments, std::move(merged));
+        merging_ = false;
+    }
+    merges_done_.notify_all();
+}
+
+std::vector<SegmentedSearchServer::Segment> SegmentedSearchServer::PlanMerge() const {
+    const auto& segments = generation_.Get().segments;
+    const size_t sealed_count = segments.size() - 1;
+    // Tier t holds segments of write_segment_size * MERGE_FACTOR^t documents and up
+    std::map<int, std::vector<Segment>> tiers;
+    for (size_t position = 0; position < sealed_count; ++position) {
+        const Segment& segment = segments[position];
+        const size_t size = segment.index->GetDocumentCount();
+        // A segment with many removed documents is rewritten alone to drop them
+        if (segment.tombstones && 4 * segment.tombstones->document_ids.size() >= size) {
+            return {segment};
+        }
+        int tier = 0;
+        for (size_t bound = write_segment_size_ * MERGE_FACTOR; size >= bound; bound *= MERGE_FACTOR) {
+            ++tier;
+        }
+        auto& tier_segments = tiers[tier];
+        tier_segments.push_back(segment);
+        if (tier_segments.size() == MERGE_FACTOR) {
+            return tier_segments;
+        }
+    }
+    return {};
+}
+
+SearchServer SegmentedSearchServer::MergeSegments(const std::vector<Segment>& segments) const {
+    SearchServer merged(empty_segment_);
+    for (const Segment& segment : segments) {
+        merged.AddDocumentsFrom(*segment.index, segment.tombstones ? segment.tombstones->document_ids : std::set<int>());
+    }
+    merged.CompressPostings();
+    return merged;
+}
+
+void SegmentedSearchServer::InstallMerge(const std::vector<Segment>& segments, std::shared_ptr<const SearchServer> merged) {
+    auto next = std::make_shared<Generation>(generation_.Get());
+    std::vector<Segment> kept;
+    size_t merged_position = next->segments.size();
+    std::vector<int> removed_meanwhile;
+    for (const Segment& segment : next->segments) {
+        const auto source = std::find_if(segments.begin(), segments.end(), [&segment](const Segment& source) {
+            return source.index == segment.index;
+        });
+        if (source == segments.end()) {
+            kept.push_back(segment);
+            continue;
+        }
+        merged_position = std::min(merged_position, kept.size());
+        if (segment.tombstones) {
+            for (const int document_id : segment.tombstones->document_ids) {
+                if (!source->tombstones || source->tombstones->document_ids.count(document_id) == 0) {
+                    removed_meanwhile.push_back(document_id);
+                }
+            }
+        }
+    }
+    if (merged->GetDocumentCount() > static_cast<int>(removed_meanwhile.size())) {
+        Segment segment{std::move(merged), nullptr};
+        if (!removed_meanwhile.empty()) {
+            segment.tombstones = AddTombstones(segment, removed_meanwhile);
+        }
+        kept.insert(kept.begin() + merged_position, std::move(segment));
+    }
+    next->segments = std::move(kept);
+    PublishGeneration(std::move(next));
+}
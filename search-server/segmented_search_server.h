@@ -0,0 +1,210 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <execution>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "published.h"
+#include "search_server.h"
+#include "top_documents.h"
+
+// An index split into immutable segments, for a corpus that keeps changing.
+// New documents go to a small write segment, which is compressed and sealed once it holds
+// write_segment_size documents. Removing a document of a sealed segment only records a tombstone.
+// A background thread merges sealed segments of one size tier into the next one and drops removed
+// documents on the way, so a document is rewritten a logarithmic number of times.
+// Queries pin the current set of segments, search every segment with the inverse document
+// frequencies of the whole corpus and never wait for writers or merges.
+// Changes of the write segment are published by the background thread about every REFRESH_INTERVAL,
+// sealed segments and tombstones right away. Refresh publishes everything at once
+class SegmentedSearchServer {
+public:
+    static constexpr size_t DEFAULT_WRITE_SEGMENT_SIZE = 1024;
+    // Segments of one size tier are merged as soon as there are this many of them
+    static constexpr size_t MERGE_FACTOR = 4;
+    // Every refresh copies the write segment, so changes are collected for a while
+    static constexpr std::chrono::milliseconds REFRESH_INTERVAL{10};
+
+    template <typename StringContainer>
+    explicit SegmentedSearchServer(const StringContainer& stop_words, size_t write_segment_size = DEFAULT_WRITE_SEGMENT_SIZE);
+    explicit SegmentedSearchServer(const std::string& stop_words_text, size_t write_segment_size = DEFAULT_WRITE_SEGMENT_SIZE);
+    ~SegmentedSearchServer();
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    // A batch of at least write_segment_size documents is tokenized in parallel into a sealed segment of its own
+    void AddDocuments(const std::vector<RawDocument>& documents);
+    void RemoveDocument(int document_id);
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count = SearchServer::MAX_RESULT_DOCUMENT_COUNT) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count = SearchServer::MAX_RESULT_DOCUMENT_COUNT) const;
+    // Segments are searched in parallel
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count = SearchServer::MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status, size_t max_result_count = SearchServer::MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentStatus status, size_t max_result_count = SearchServer::MAX_RESULT_DOCUMENT_COUNT) const;
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentStatus status, size_t max_result_count = SearchServer::MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query) const;
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query) const;
+
+    // Makes all changes made so far visible to queries
+    void Refresh();
+
+    // Documents visible to queries
+    int GetDocumentCount() const;
+    // Sealed segments and the write segment
+    size_t GetSegmentCount() const;
+    // Blocks until the background thread has no merge left to do
+    void WaitForMerges();
+
+private:
+    // Removed documents of a sealed segment and, per word, how many of them contain it.
+    // The words point into the segment
+    struct Tombstones {
+        std::set<int> document_ids;
+        std::map<std::string_view, int, std::less<>> document_freqs;
+    };
+    struct Segment {
+        std::shared_ptr<const SearchServer> index;
+        // Null while nothing is removed
+        std::shared_ptr<const Tombstones> tombstones;
+    };
+    // What queries see, never changed once published
+    struct Generation {
+        // Sealed segments, then the published copy of the write segment
+        std::vector<Segment> segments;
+        int document_count = 0;
+
+        double ComputeWordInverseDocumentFreq(std::string_view word) const;
+    };
+
+    const size_t write_segment_size_;
+    // Copied to start every new segment
+    const SearchServer empty_segment_;
+    Published<Generation> generation_;
+    // Serializes writers and the background thread, guards everything below
+    std::mutex write_mutex_;
+    // Changed in place, queries see its copies only
+    std::shared_ptr<SearchServer> write_segment_;
+    bool write_segment_changed_ = false;
+    std::set<int> document_ids_;
+    std::condition_variable background_wanted_;
+    std::condition_variable merges_done_;
+    bool merging_ = false;
+    bool stopped_ = false;
+    // Started last, when everything it uses is in place
+    std::thread background_thread_;
+
+    // Counts the visible documents of next and publishes it
+    void PublishGeneration(std::shared_ptr<Generation> next);
+    // Publishes a copy of the write segment, write_mutex_ must be held
+    void RefreshLocked();
+    void MarkWriteSegmentChanged();
+    // A full write segment is compressed and sealed as it is, an empty one takes its place
+    void SealWriteSegmentIfFull();
+    static std::shared_ptr<const Tombstones> AddTombstones(const Segment& segment, const std::vector<int>& document_ids);
+
+    // Refreshes and merges
+    void BackgroundLoop();
+    // Sealed segments to merge into one, empty if there is nothing to do
+    std::vector<Segment> PlanMerge() const;
+    SearchServer MergeSegments(const std::vector<Segment>& segments) const;
+    // Replaces the merged segments, documents removed from them meanwhile get tombstones in the result
+    void InstallMerge(const std::vector<Segment>& segments, std::shared_ptr<const SearchServer> merged);
+
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocumentsInSegments(const ExecutionPolicy& policy, std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count) const;
+};
+
+template <typename StringContainer>
+SegmentedSearchServer::SegmentedSearchServer(const StringContainer& stop_words, size_t write_segment_size)
+    : write_segment_size_(std::max<size_t>(write_segment_size, 1))
+    , empty_segment_(stop_words)
+    , generation_(std::make_shared<const Generation>(Generation{{{std::make_shared<const SearchServer>(empty_segment_), nullptr}}, 0}))
+    , write_segment_(std::make_shared<SearchServer>(empty_segment_))
+    , background_thread_(&SegmentedSearchServer::BackgroundLoop, this) {
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count) const {
+    return FindTopDocumentsInSegments(std::execution::seq, raw_query, document_predicate, max_result_count);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(const std::execution::sequenced_policy&, std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count) const {
+    return FindTopDocumentsInSegments(std::execution::seq, raw_query, document_predicate, max_result_count);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(const std::execution::parallel_policy&, std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count) const {
+    return FindTopDocumentsInSegments(std::execution::par, raw_query, document_predicate, max_result_count);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SegmentedSearchServer::FindTopDocumentsInSegments(const ExecutionPolicy& policy, std::string_view raw_query, DocumentPredicate document_predicate, size_t max_result_count) const {
+    const auto generation = generation_.Pin();
+    const auto& segments = generation->segments;
+    // Every segment asks for the weights of its own query words, they are computed once up front.
+    // Invalid words are left to the segments to report
+    std::unordered_map<std::string_view, double> inv_document_freqs;
+    for (const std::string_view word : SplitIntoWords(raw_query)) {
+        if (!word.empty() && word[0] != '-') {
+            inv_document_freqs.emplace(word, 0.0);
+        }
+    }
+    for (auto& [word, inv_document_freq] : inv_document_freqs) {
+        inv_document_freq = generation->ComputeWordInverseDocumentFreq(word);
+    }
+    const auto inv_document_freq = [&inv_document_freqs](std::string_view word) {
+        return inv_document_freqs.at(word);
+    };
+    // Exceptions must not escape a parallel algorithm, they are parked and the first one is rethrown
+    std::vector<std::vector<Document>> results(segments.size());
+    std::vector<std::exception_ptr> errors(segments.size());
+    std::vector<size_t> positions(segments.size());
+    std::iota(positions.begin(), positions.end(), 0);
+    std::for_each(policy, positions.begin(), positions.end(), [&](size_t position) {
+        const Segment& segment = segments[position];
+        try {
+            if (!segment.tombstones) {
+                results[position] = segment.index->FindTopDocumentsInCorpus(std::execution::seq, raw_query, document_predicate,
+                                                                             inv_document_freq, max_result_count);
+                return;
+            }
+            const std::set<int>& removed = segment.tombstones->document_ids;
+            const auto live_predicate = [&removed, &document_predicate](int document_id, DocumentStatus status, int rating) {
+                return removed.count(document_id) == 0 && document_predicate(document_id, status, rating);
+            };
+            results[position] = segment.index->FindTopDocumentsInCorpus(std::execution::seq, raw_query, live_predicate,
+                                                                         inv_document_freq, max_result_count);
+        } catch (...) {
+            errors[position] = std::current_exception();
+        }
+    });
+    for (const auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    TopDocuments top_documents(max_result_count);
+    for (const auto& documents : results) {
+        for (const Document& document : documents) {
+            top_documents.Push(document);
+        }
+    }
+    return top_documents.Extract();
+}
@@ -0,0 +1,107 @@
+#include "snapshot.h"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std::string_literals;
+
+bool IsLittleEndianHost() {
+    const uint16_t probe = 1;
+    char first_byte;
+    std::memcpy(&first_byte, &probe, 1);
+    return first_byte == 1;
+}
+
+uint64_t UpdateSnapshotChecksum(uint64_t checksum, const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        checksum ^= static_cast<unsigned char>(data[i]);
+        checksum *= 1099511628211ull;
+    }
+    return checksum;
+}
+
+SnapshotWriter::SnapshotWriter(const std::string& path)
+    : path_(path)
+    , temporary_path_(path + ".tmp"s)
+    , out_(temporary_path_, std::ios::binary | std::ios::trunc) {
+    if (!out_) {
+        throw std::runtime_error("Cannot create snapshot file "s + temporary_path_);
+    }
+    const SnapshotHeader placeholder{};
+    out_.write(reinterpret_cast<const char*>(&placeholder), sizeof(placeholder));
+    offset_ = sizeof(placeholder);
+}
+
+void SnapshotWriter::Write(const void* data, size_t size) {
+    out_.write(static_cast<const char*>(data), size);
+    checksum_ = UpdateSnapshotChecksum(checksum_, static_cast<const char*>(data), size);
+    offset_ += size;
+}
+
+void SnapshotWriter::Align() {
+    const char zeroes[8] = {};
+    Write(zeroes, (8 - offset_ % 8) % 8);
+}
+
+uint64_t SnapshotWriter::GetOffset() const {
+    return offset_;
+}
+
+uint64_t SnapshotWriter::TakeChecksum() {
+    const uint64_t checksum = checksum_;
+    checksum_ = SNAPSHOT_CHECKSUM_SEED;
+    return checksum;
+}
+
+void SnapshotWriter::Finish(SnapshotHeader header) {
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.file_size = offset_;
+    out_.seekp(0);
+    out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out_.close();
+    if (!out_ || std::rename(temporary_path_.c_str(), path_.c_str()) != 0) {
+        std::remove(temporary_path_.c_str());
+        throw std::runtime_error("Cannot write snapshot file "s + path_);
+    }
+}
+
+MappedFile::MappedFile(const std::string& path) {
+    const int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        throw std::runtime_error("Cannot open snapshot file "s + path);
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        close(descriptor);
+        throw std::runtime_error("Cannot stat snapshot file "s + path);
+    }
+    size_ = status.st_size;
+    if (size_ > 0) {
+        void* mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapping == MAP_FAILED) {
+            close(descriptor);
+            throw std::runtime_error("Cannot map snapshot file "s + path);
+        }
+        data_ = static_cast<const char*>(mapping);
+    }
+    close(descriptor);
+}
+
+MappedFile::~MappedFile() {
+    if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+const char* MappedFile::data() const {
+    return data_;
+}
+
+size_t MappedFile::size() const {
+    return size_;
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include "forward_index.h"
+#include "posting_list.h"
+
+// On-disk layout of SearchServer snapshots. All integers are little-endian, every section
+// starts at an 8-byte boundary and the posting and term sections have exactly the in-memory
+// layout of Posting and TermFrequency, so a memory-mapped file is used as their storage directly.
+// The bulk of the file, postings and terms, comes last under a checksum of its own.
+//
+//   SnapshotHeader
+//   arena         characters of all stop words and vocabulary words
+//   stop words    SnapshotString[stop_word_count]
+//   words         SnapshotWord[word_count], position is the term id
+//   blocks        PostingBlockBounds[block_count], grouped by word, one per BLOCK_SIZE postings
+//   documents     SnapshotDocument[document_count], position is the document index
+//   term offsets  uint64_t[document_count + 1], the terms of document i are terms[offsets[i]] ... terms[offsets[i + 1] - 1]
+//   idfs          double[word_count], only with SNAPSHOT_FROZEN_IDFS set
+//   postings      Posting[posting_count], grouped by word, sorted by document index
+//   terms         TermFrequency[posting_count], grouped by document, sorted by term id
+
+const char SNAPSHOT_MAGIC[8] = {'S', 'R', 'C', 'H', 'S', 'N', 'A', 'P'};
+const uint32_t SNAPSHOT_VERSION = 4;
+
+// Header flags
+const uint32_t SNAPSHOT_FROZEN_IDFS = 1;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t file_size;
+    // FNV-1a of every byte after the header up to the postings
+    uint64_t checksum;
+    // FNV-1a of the postings and terms
+    uint64_t postings_checksum;
+    uint64_t stop_word_count;
+    uint64_t word_count;
+    uint64_t block_count;
+    uint64_t posting_count;
+    uint64_t document_count;
+    uint64_t arena_offset;
+    uint64_t arena_size;
+    uint64_t stop_words_offset;
+    uint64_t words_offset;
+    uint64_t blocks_offset;
+    uint64_t documents_offset;
+    uint64_t term_offsets_offset;
+    uint64_t idfs_offset;
+    uint64_t postings_offset;
+    uint64_t terms_offset;
+};
+
+struct SnapshotString {
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct SnapshotWord {
+    SnapshotString text;
+    uint64_t postings_offset;
+    uint64_t postings_count;
+    uint64_t blocks_offset;
+};
+
+struct SnapshotDocument {
+    int32_t id;
+    int32_t rating;
+    int32_t status;
+    int32_t word_count;
+};
+
+static_assert(sizeof(Posting) == 16 && offsetof(Posting, document_index) == 0 && offsetof(Posting, term_freq) == 8,
+              "Snapshot postings are mapped as Posting");
+static_assert(sizeof(PostingBlockBounds) == 16 && offsetof(PostingBlockBounds, last_document_index) == 0
+                  && offsetof(PostingBlockBounds, max_term_freq) == 8,
+              "Snapshot blocks are mapped as PostingBlockBounds");
+static_assert(sizeof(TermFrequency) == 16 && offsetof(TermFrequency, term) == 0 && offsetof(TermFrequency, term_freq) == 8,
+              "Snapshot terms are mapped as TermFrequency");
+
+bool IsLittleEndianHost();
+
+uint64_t UpdateSnapshotChecksum(uint64_t checksum, const char* data, size_t size);
+const uint64_t SNAPSHOT_CHECKSUM_SEED = 14695981039346656037ull;
+
+// Sequential writer that tracks the offset and the checksum of everything written after the header.
+// Data goes to a temporary file that replaces path only in Finish, so a snapshot that is
+// still mapped by a running server is never truncated under it
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string& path);
+
+    void Write(const void* data, size_t size);
+    // Pads with zeroes up to the next 8-byte boundary
+    void Align();
+    uint64_t GetOffset() const;
+    // Checksum of everything written since the header or the previous call
+    uint64_t TakeChecksum();
+    // Rewrites the header at the start of the file once all sections are known
+    void Finish(SnapshotHeader header);
+
+private:
+    std::string path_;
+    std::string temporary_path_;
+    std::ofstream out_;
+    uint64_t offset_ = 0;
+    uint64_t checksum_ = SNAPSHOT_CHECKSUM_SEED;
+};
+
+// Read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const;
+    size_t size() const;
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
@@ -1,4 +1,8 @@
 #include "string_processing.h"
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 /*std::vector<std::string> SplitIntoWords(const std::string& text) {
     std::vector<std::string> words;
     std::string word;
@@ -18,16 +22,111 @@
 
     return words;
 }*/
- 
-std::vector<std::string_view> SplitIntoWords(std::string_view text) {
-    std::vector<std::string_view> words;
-    std::string_view space = " ";
-    int64_t start = text.find_first_not_of(space);
-    const int64_t end = text.npos;
-    while (start != end) {
-        int64_t space_ = text.find(' ', start);
-        words.push_back(space_ == end ? text.substr(start) : text.substr(start, space_ - start));
-        start = text.find_first_not_of(space, space_);
+
+namespace {
+
+int CountTrailingZeros(uint32_t bits) {
+#ifdef __GNUC__
+    return __builtin_ctz(bits);
+#else
+    int count = 0;
+    while ((bits & 1) == 0) {
+        bits >>= 1;
+        ++count;
     }
-    return words;
+    return count;
+#endif
+}
+
+}
+
+WordSeparators::WordSeparators()
+    : WordSeparators(" ") {
+}
+
+WordSeparators::WordSeparators(std::string_view separators) {
+    for (const char c : separators) {
+        bool& is_separator = table_[static_cast<unsigned char>(c)];
+        if (is_separator) {
+            continue;
+        }
+        is_separator = true;
+        if (byte_count_ < bytes_.size()) {
+            bytes_[byte_count_] = c;
+        }
+        ++byte_count_;
+    }
+}
+
+void WordSeparators::Classify(const char* block, size_t length, uint32_t& separator_bits, uint32_t& control_bits) const {
+#ifdef __SSE2__
+    if (length == BLOCK_SIZE && byte_count_ <= MAX_VECTOR_SEPARATOR_COUNT) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+        __m128i separators = _mm_setzero_si128();
+        for (size_t i = 0; i < byte_count_; ++i) {
+            separators = _mm_or_si128(separators, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(bytes_[i])));
+        }
+        // Unsigned bytes up to 0x1F are the ones that do not change under min(byte, 0x1F)
+        const __m128i controls = _mm_cmpeq_epi8(_mm_min_epu8(bytes, _mm_set1_epi8(0x1F)), bytes);
+        separator_bits = _mm_movemask_epi8(separators);
+        control_bits = _mm_movemask_epi8(controls);
+        return;
+    }
+#endif
+    separator_bits = 0;
+    control_bits = 0;
+    for (size_t i = 0; i < length; ++i) {
+        const unsigned char c = block[i];
+        separator_bits |= static_cast<uint32_t>(table_[c]) << i;
+        control_bits |= static_cast<uint32_t>(c < ' ') << i;
+    }
+}
+
+void SplitIntoWords(std::string_view text, const WordSeparators& separators, SplitText& result) {
+    result.words.clear();
+    size_t first_control = text.size();
+    size_t word_begin = 0;
+    bool in_word = false;
+    for (size_t block = 0; block < text.size(); block += WordSeparators::BLOCK_SIZE) {
+        const size_t length = std::min(WordSeparators::BLOCK_SIZE, text.size() - block);
+        uint32_t separator_bits;
+        uint32_t control_bits;
+        separators.Classify(text.data() + block, length, separator_bits, control_bits);
+        const uint32_t block_bits = (1u << length) - 1;
+        const uint32_t word_bits = ~separator_bits & block_bits;
+        control_bits &= word_bits;
+        if (control_bits != 0 && first_control == text.size()) {
+            first_control = block + CountTrailingZeros(control_bits);
+        }
+        // Words start and end where a byte differs from the one before it
+        uint32_t boundaries = (word_bits ^ ((word_bits << 1) | in_word)) & block_bits;
+        while (boundaries != 0) {
+            const size_t position = block + CountTrailingZeros(boundaries);
+            if (in_word) {
+                result.words.push_back(text.substr(word_begin, position - word_begin));
+            } else {
+                word_begin = position;
+            }
+            in_word = !in_word;
+            boundaries &= boundaries - 1;
+        }
+    }
+    if (in_word) {
+        result.words.push_back(text.substr(word_begin));
+    }
+    result.first_invalid_word = result.words.size();
+    if (first_control < text.size()) {
+        const char* control = text.data() + first_control;
+        const auto word = std::upper_bound(result.words.begin(), result.words.end(), control, [](const char* control, std::string_view word) {
+            return control < word.data();
+        });
+        result.first_invalid_word = word - result.words.begin() - 1;
+    }
+}
+
+std::vector<std::string_view> SplitIntoWords(std::string_view text) {
+    static const WordSeparators spaces;
+    SplitText result;
+    SplitIntoWords(text, spaces, result);
+    return std::move(result.words);
 }
@@ -1,7 +1,45 @@
 #pragma once
+#include <array>
+#include <cstdint>
 #include <set>
 #include <vector>
 #include <string>
+#include <string_view>
+
+// Bytes that separate words, a space by default
+class WordSeparators {
+public:
+    static constexpr size_t BLOCK_SIZE = 16;
+    // Up to this many distinct separators are compared a block at a time, more are looked up byte by byte
+    static constexpr size_t MAX_VECTOR_SEPARATOR_COUNT = 8;
+
+    WordSeparators();
+    explicit WordSeparators(std::string_view separators);
+
+    bool IsSeparator(char c) const {
+        return table_[static_cast<unsigned char>(c)];
+    }
+
+    // Bit i of separator_bits and control_bits tells whether block[i] is a separator and whether it is
+    // a control character (below a space), for up to BLOCK_SIZE bytes
+    void Classify(const char* block, size_t length, uint32_t& separator_bits, uint32_t& control_bits) const;
+
+private:
+    std::array<bool, 256> table_{};
+    std::array<char, MAX_VECTOR_SEPARATOR_COUNT> bytes_{};
+    size_t byte_count_ = 0;
+};
+
+// The words of a text, meant to be reused so that splitting does not allocate
+struct SplitText {
+    std::vector<std::string_view> words;
+    // Index of the first word with a control character that is not a separator, words.size() if there is none
+    size_t first_invalid_word = 0;
+};
+
+// Finds the words and checks them for control characters in a single pass over text,
+// 16 bytes at a time where SSE2 is available
+void SplitIntoWords(std::string_view text, const WordSeparators& separators, SplitText& result);
 
 std::vector<std::string_view> SplitIntoWords(const std::string_view text);
  
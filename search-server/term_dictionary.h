@@ -0,0 +1,126 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "copy_on_write.h"
+
+using TermId = uint32_t;
+
+// Interns every word once and hands out dense 32-bit ids for it.
+// Ids of released words are reused, so the id space stays as small as the live vocabulary.
+// Copies share the words until one of them adds or releases a word and copies them for itself
+class TermDictionary {
+public:
+    // Id of the word, a copy of the text is stored when the word is new
+    TermId Intern(std::string_view word) {
+        if (const auto term = Find(word)) {
+            return *term;
+        }
+        Words& words = GetOwnCopy(words_);
+        return words.Insert(words.StoreText(word), true);
+    }
+
+    // Registers a word whose text is kept alive by the caller (e.g. a mapped snapshot)
+    TermId InternBorrowed(std::string_view word) {
+        if (const auto term = Find(word)) {
+            return *term;
+        }
+        return GetOwnCopy(words_).Insert(word, false);
+    }
+
+    std::optional<TermId> Find(std::string_view word) const {
+        if (!words_) {
+            return std::nullopt;
+        }
+        const auto term = words_->ids.find(word);
+        if (term == words_->ids.end()) {
+            return std::nullopt;
+        }
+        return term->second;
+    }
+
+    std::string_view GetText(TermId term) const {
+        return words_->texts[term];
+    }
+
+    void Release(TermId term) {
+        Words& words = GetOwnCopy(words_);
+        const std::string_view word = words.texts[term];
+        words.ids.erase(word);
+        if (words.owned[term]) {
+            words.storage->deallocate(const_cast<char*>(word.data()), word.size(), 1);
+        }
+        words.texts[term] = {};
+        words.free_ids.push_back(term);
+    }
+
+    // Upper bound of the ids handed out so far
+    size_t GetIdBound() const {
+        return words_ ? words_->texts.size() : 0;
+    }
+
+private:
+    struct Words {
+        // Texts of the owned words, packed by size class and reused after release. On the heap, so the
+        // views stay valid when the words move; declared first, so it outlives them on assignment
+        std::unique_ptr<std::pmr::unsynchronized_pool_resource> storage;
+        std::unordered_map<std::string_view, TermId> ids;
+        std::vector<std::string_view> texts;
+        // Indexed by term id: the text is in storage rather than borrowed
+        std::vector<bool> owned;
+        std::vector<TermId> free_ids;
+
+        Words() = default;
+
+        // A copy points into its own copies of the owned words, borrowed texts stay shared
+        Words(const Words& other)
+            : texts(other.texts)
+            , owned(other.owned)
+            , free_ids(other.free_ids) {
+            ids.reserve(other.ids.size());
+            for (TermId term = 0; term < texts.size(); ++term) {
+                if (texts[term].empty()) {
+                    continue;
+                }
+                if (owned[term]) {
+                    texts[term] = StoreText(texts[term]);
+                }
+                ids.emplace(texts[term], term);
+            }
+        }
+
+        std::string_view StoreText(std::string_view word) {
+            if (!storage) {
+                storage = std::make_unique<std::pmr::unsynchronized_pool_resource>();
+            }
+            char* text = static_cast<char*>(storage->allocate(word.size(), 1));
+            std::memcpy(text, word.data(), word.size());
+            return {text, word.size()};
+        }
+
+        TermId Insert(std::string_view stored_word, bool is_owned) {
+            TermId term;
+            if (!free_ids.empty()) {
+                term = free_ids.back();
+                free_ids.pop_back();
+                texts[term] = stored_word;
+                owned[term] = is_owned;
+            } else {
+                term = texts.size();
+                texts.push_back(stored_word);
+                owned.push_back(is_owned);
+            }
+            ids.emplace(stored_word, term);
+            return term;
+        }
+    };
+
+    // Null until the first word
+    std::shared_ptr<Words> words_;
+};
@@ -1,5 +1,256 @@
 #include "test_example_functions.h"
+#include "generators.h"
+#include "posting_codec.h"
+#include "remove_duplicates.h"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
  
 void AddDocument(SearchServer& search_server, int document_id, const std::string& document, DocumentStatus status, const std::vector<int>& ratings){
         search_server.AddDocument(document_id, document, status, ratings);
 }
+
+namespace {
+
+const string SNAPSHOT_PATH = "test_example_functions.snapshot"s;
+
+SearchServer MakeTestServer() {
+    SearchServer search_server("and in on with"s);
+    AddDocument(search_server, 1, "white cat and fashionable collar"s, DocumentStatus::ACTUAL, {8, -3});
+    AddDocument(search_server, 2, "fluffy cat fluffy tail"s, DocumentStatus::ACTUAL, {7, 2, 7});
+    AddDocument(search_server, 3, "groomed dog expressive eyes"s, DocumentStatus::ACTUAL, {5, -12, 2, 1});
+    AddDocument(search_server, 4, "groomed starling evgeny"s, DocumentStatus::BANNED, {9});
+    AddDocument(search_server, 5, "white dog with a fluffy collar"s, DocumentStatus::IRRELEVANT, {1, 1});
+    AddDocument(search_server, 6, "cat in a box on the white sofa"s, DocumentStatus::ACTUAL, {4});
+    search_server.RemoveDocument(5);
+    return search_server;
+}
+
+bool SameDocuments(const vector<Document>& lhs, const vector<Document>& rhs) {
+    return lhs.size() == rhs.size() && equal(lhs.begin(), lhs.end(), rhs.begin(), [](const Document& lhs, const Document& rhs) {
+        return lhs.id == rhs.id && lhs.relevance == rhs.relevance && lhs.rating == rhs.rating;
+    });
+}
+
+void AssertSameServers(const SearchServer& expected, const SearchServer& actual) {
+    assert(actual.GetDocumentCount() == expected.GetDocumentCount());
+    assert(equal(expected.begin(), expected.end(), actual.begin(), actual.end()));
+    for (const string& query : {"fluffy groomed cat"s, "white collar -dog"s, "evgeny"s, "sofa box cat white"s, "parrot"s}) {
+        assert(SameDocuments(actual.FindTopDocuments(query), expected.FindTopDocuments(query)));
+        assert(SameDocuments(actual.FindTopDocuments(query, DocumentStatus::BANNED), expected.FindTopDocuments(query, DocumentStatus::BANNED)));
+        for (const int document_id : expected) {
+            const auto [expected_words, expected_status] = expected.MatchDocument(query, document_id);
+            const auto [actual_words, actual_status] = actual.MatchDocument(query, document_id);
+            assert(actual_words == expected_words && actual_status == expected_status);
+        }
+    }
+}
+
+string ReadFile(const string& path) {
+    ifstream in(path, ios::binary);
+    return {istreambuf_iterator<char>(in), istreambuf_iterator<char>()};
+}
+
+void WriteFile(const string& path, const string& bytes) {
+    ofstream(path, ios::binary) << bytes;
+}
+
+bool LoadFails(const string& path, bool verify_checksum) {
+    try {
+        SearchServer::LoadSnapshot(path, verify_checksum);
+    } catch (const runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+}  // namespace
+
+void TestSnapshotRoundTrip() {
+    SearchServer search_server = MakeTestServer();
+    for (const bool compressed : {false, true}) {
+        if (compressed) {
+            search_server.CompressPostings();
+        }
+        search_server.SaveSnapshot(SNAPSHOT_PATH);
+        {
+            const SearchServer loaded = SearchServer::LoadSnapshot(SNAPSHOT_PATH, true);
+            AssertSameServers(search_server, loaded);
+            // A loaded server takes changes like any other
+            SearchServer changed = loaded;
+            changed.RemoveDocument(1);
+            AddDocument(changed, 7, "white cat"s, DocumentStatus::ACTUAL, {3});
+            SearchServer expected = search_server;
+            expected.RemoveDocument(1);
+            AddDocument(expected, 7, "white cat"s, DocumentStatus::ACTUAL, {3});
+            AssertSameServers(expected, changed);
+        }
+        remove(SNAPSHOT_PATH.c_str());
+    }
+}
+
+void TestSnapshotCorruption() {
+    MakeTestServer().SaveSnapshot(SNAPSHOT_PATH);
+    const string bytes = ReadFile(SNAPSHOT_PATH);
+    SnapshotHeader header;
+    memcpy(&header, bytes.data(), sizeof(header));
+    const auto damage = [&bytes](size_t offset) {
+        string damaged = bytes;
+        damaged[offset] ^= 1;
+        WriteFile(SNAPSHOT_PATH, damaged);
+    };
+
+    // Tables are checked on every load
+    damage(header.documents_offset + offsetof(SnapshotDocument, rating));
+    assert(LoadFails(SNAPSHOT_PATH, false));
+    damage(header.arena_offset);
+    assert(LoadFails(SNAPSHOT_PATH, false));
+    WriteFile(SNAPSHOT_PATH, bytes.substr(0, bytes.size() - 8));
+    assert(LoadFails(SNAPSHOT_PATH, false));
+
+    // Postings and terms are checked on request
+    damage(header.postings_offset + offsetof(Posting, term_freq));
+    assert(LoadFails(SNAPSHOT_PATH, true));
+    damage(header.terms_offset + offsetof(TermFrequency, term_freq));
+    assert(LoadFails(SNAPSHOT_PATH, true));
+
+    WriteFile(SNAPSHOT_PATH, bytes);
+    assert(!LoadFails(SNAPSHOT_PATH, true));
+    remove(SNAPSHOT_PATH.c_str());
+}
+
+void TestStreamVByteDecoders() {
+    mt19937 generator;
+    for (size_t count = 0; count <= 130; ++count) {
+        // Values of every byte length, the largest included
+        vector<uint32_t> values(count);
+        for (size_t i = 0; i < count; ++i) {
+            const int bits = uniform_int_distribution(0, 32)(generator);
+            values[i] = bits == 32 ? numeric_limits<uint32_t>::max() : uniform_int_distribution<uint32_t>(0, (1u << bits) - 1)(generator);
+        }
+        vector<uint8_t> bytes;
+        EncodeStreamVByte(values.data(), count, bytes);
+        const size_t encoded_size = bytes.size();
+        bytes.resize(encoded_size + STREAM_VBYTE_PADDING);
+
+        // DecodeStreamVByte runs the SSSE3 kernel where the CPU has it
+        vector<uint32_t> decoded(count);
+        assert(DecodeStreamVByte(bytes.data(), count, decoded.data()) == bytes.data() + encoded_size);
+        assert(decoded == values);
+        vector<uint32_t> decoded_scalar(count);
+        assert(DecodeStreamVByteScalar(bytes.data(), count, decoded_scalar.data()) == bytes.data() + encoded_size);
+        assert(decoded_scalar == values);
+    }
+}
+
+void TestRemoveNearDuplicates() {
+    const string words = "red fox jumps over lazy brown dog near old barn"s;
+    SearchServer search_server("and in on with"s);
+    AddDocument(search_server, 1, words, DocumentStatus::ACTUAL, {1});
+    // 10 of 11 words shared: similarity 0.91
+    AddDocument(search_server, 2, words + " today"s, DocumentStatus::ACTUAL, {2});
+    // The same word set in another order, repeats and stop words do not count
+    AddDocument(search_server, 3, "barn old near dog brown lazy over jumps fox red red and fox"s, DocumentStatus::ACTUAL, {3});
+    // 7 of 13 words shared: similarity 0.54
+    AddDocument(search_server, 4, "red fox jumps over lazy brown dog in green wet field"s, DocumentStatus::ACTUAL, {4});
+    AddDocument(search_server, 5, "quiet evening at home with tea"s, DocumentStatus::ACTUAL, {5});
+    // Similar to the kept document 4 only: 9 of 10 words shared
+    AddDocument(search_server, 6, "red fox jumps over lazy brown dog green wet"s, DocumentStatus::BANNED, {6});
+
+    SearchServer exact = search_server;
+    RemoveNearDuplicates(search_server, 0.8);
+    assert(vector<int>(search_server.begin(), search_server.end()) == vector<int>({1, 4, 5}));
+    // A threshold of 1 removes equal word sets only
+    RemoveNearDuplicates(exact, 1.0);
+    assert(vector<int>(exact.begin(), exact.end()) == vector<int>({1, 2, 4, 5, 6}));
+
+    for (const double similarity_threshold : {0.0, -0.5, 1.5}) {
+        try {
+            RemoveNearDuplicates(exact, similarity_threshold);
+            assert(false);
+        } catch (const invalid_argument&) {
+        }
+    }
+}
+
+void TestScorePruning() {
+    mt19937 generator;
+    const vector<string> dictionary = GenerateDictionary(generator, 300, 8);
+    SearchServer search_server(dictionary[0]);
+    for (int id = 0; id < 3000; ++id) {
+        // Distinct ratings, so documents of equal relevance come in one order whatever the evaluation
+        const string document = GenerateQuery(generator, dictionary, uniform_int_distribution(5, 60)(generator));
+        AddDocument(search_server, id, document, static_cast<DocumentStatus>(id % DOCUMENT_STATUS_COUNT), {id});
+    }
+    vector<string> queries;
+    for (int i = 0; i < 100; ++i) {
+        queries.push_back(GenerateQuery(generator, dictionary, uniform_int_distribution(4, 12)(generator), 0.1));
+    }
+    const Bm25Ranking bm25;
+    const auto is_even = [](int document_id, DocumentStatus, int) {
+        return document_id % 2 == 0;
+    };
+    for (const bool compressed : {false, true}) {
+        if (compressed) {
+            search_server.CompressPostings();
+        }
+        SearchServer pruned = search_server;
+        pruned.SetScorePruning(true);
+        for (const string& query : queries) {
+            for (const size_t max_result_count : {1, 5, 50}) {
+                assert(SameDocuments(pruned.FindTopDocuments(query, DocumentStatus::ACTUAL, max_result_count),
+                                     search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, max_result_count)));
+                assert(SameDocuments(pruned.FindTopDocuments(query, is_even, max_result_count), search_server.FindTopDocuments(query, is_even, max_result_count)));
+                assert(SameDocuments(pruned.FindTopDocuments(query, is_even, bm25, max_result_count),
+                                     search_server.FindTopDocuments(query, is_even, bm25, max_result_count)));
+            }
+        }
+    }
+}
+
+void TestResultCacheInvalidation() {
+    SearchServer search_server = MakeTestServer();
+    search_server.SetResultCacheCapacity(1000);
+    const auto assert_stats = [](const SearchServer& search_server, uint64_t hits, uint64_t misses) {
+        const ResultCacheStats stats = search_server.GetResultCacheStats();
+        assert(stats.hits == hits && stats.misses == misses);
+    };
+    const string query = "fluffy white cat"s;
+    const vector<Document> expected = search_server.FindTopDocuments(query);
+    // Word order and repeats do not matter
+    assert(SameDocuments(search_server.FindTopDocuments(query), expected));
+    assert(SameDocuments(search_server.FindTopDocuments("cat white fluffy fluffy"s), expected));
+    assert_stats(search_server, 2, 1);
+
+    AddDocument(search_server, 10, "fluffy white cat"s, DocumentStatus::ACTUAL, {1});
+    assert(search_server.FindTopDocuments(query).front().id == 10);
+    assert_stats(search_server, 2, 2);
+    search_server.RemoveDocument(10);
+    assert(SameDocuments(search_server.FindTopDocuments(query), expected));
+    assert_stats(search_server, 2, 3);
+    search_server.RemoveDocuments({2});
+    assert(search_server.FindTopDocuments(query).size() == expected.size() - 1);
+    assert_stats(search_server, 2, 4);
+
+    // Searches by a predicate are cached under their key
+    const auto is_even = [](int document_id, DocumentStatus, int) {
+        return document_id % 2 == 0;
+    };
+    const vector<Document> even = search_server.FindTopDocuments(query, is_even, ResultCacheKey{1});
+    assert(SameDocuments(search_server.FindTopDocuments(query, is_even, ResultCacheKey{1}), even));
+    assert_stats(search_server, 3, 5);
+    AddDocument(search_server, 12, "white cat"s, DocumentStatus::ACTUAL, {1});
+    assert(search_server.FindTopDocuments(query, is_even, ResultCacheKey{1}).size() == even.size() + 1);
+    assert_stats(search_server, 3, 6);
+
+    // A copy starts empty and changes of either server leave the other one's results alone
+    SearchServer copy = search_server;
+    assert_stats(copy, 0, 0);
+    const vector<Document> before = search_server.FindTopDocuments(query);
+    copy.RemoveDocument(before.front().id);
+    assert(copy.FindTopDocuments(query).size() == before.size() - 1);
+    assert(SameDocuments(search_server.FindTopDocuments(query), before));
+}
@@ -1,5 +1,18 @@
 #pragma once
 #include "search_server.h"
+#include <iostream>
 using namespace std;
  
 void AddDocument(SearchServer& search_server, int document_id, const std::string& document, DocumentStatus status, const std::vector<int>& ratings);
+
+// Each test checks its expectations with assert and returns if all of them hold
+void TestSnapshotRoundTrip();
+void TestSnapshotCorruption();
+void TestStreamVByteDecoders();
+void TestRemoveNearDuplicates();
+void TestScorePruning();
+void TestResultCacheInvalidation();
+
+#define RUN_TEST(test) \
+    test();            \
+    cerr << #test << " OK"s << endl
@@ -0,0 +1,54 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "document.h"
+
+// Relevances closer than this are considered equal, the higher rating wins then
+const double RELEVANCE_EPSILON = 1e-6;
+
+inline bool IsMoreRelevant(const Document& lhs, const Document& rhs) {
+    if (std::abs(lhs.relevance - rhs.relevance) < RELEVANCE_EPSILON) {
+        return lhs.rating > rhs.rating;
+    }
+    return lhs.relevance > rhs.relevance;
+}
+
+// Up to this many slots are allocated up front, a deeper page grows the heap as documents arrive
+const size_t TOP_DOCUMENTS_RESERVE_LIMIT = 64;
+
+// Keeps the best `capacity` documents seen so far in a bounded heap whose top is the weakest one,
+// so a candidate that cannot make it into the result costs a single comparison
+class TopDocuments {
+public:
+    explicit TopDocuments(size_t capacity) : capacity_(capacity) {
+        heap_.reserve(std::min(capacity, TOP_DOCUMENTS_RESERVE_LIMIT));
+    }
+
+    void Push(const Document& document) {
+        if (heap_.size() < capacity_) {
+            heap_.push_back(document);
+            std::push_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+        } else if (capacity_ > 0 && IsMoreRelevant(document, heap_.front())) {
+            std::pop_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+            heap_.back() = document;
+            std::push_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+        }
+    }
+
+    void Merge(const TopDocuments& other) {
+        for (const Document& document : other.heap_) {
+            Push(document);
+        }
+    }
+
+    // Best document first
+    std::vector<Document> Extract() {
+        std::sort_heap(heap_.begin(), heap_.end(), IsMoreRelevant);
+        return std::move(heap_);
+    }
+
+private:
+    size_t capacity_;
+    std::vector<Document> heap_;
+};